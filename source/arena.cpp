@@ -0,0 +1,93 @@
+#include <cstdlib>
+
+#include <algorithm>
+
+#include "arena.h"
+
+namespace {
+
+// smallest block to bother asking the system for
+const size_t min_block = 64 * 1024;
+
+} // namespace {}
+
+arena_t::arena_t()
+  : offset_(0)
+  , full_(0)
+  , peak_(0)
+{
+}
+
+arena_t::~arena_t() {
+  free_blocks();
+}
+
+void arena_t::free_blocks() {
+  for (const block_t &b : blocks_) {
+    free(b.base);
+  }
+  blocks_.clear();
+  offset_ = 0;
+  full_ = 0;
+}
+
+void arena_t::add_block(size_t bytes) {
+  const size_t last = blocks_.empty() ? 0 : blocks_.back().size;
+  const size_t size = std::max({bytes, last * 2, min_block});
+  uint8_t *base = (uint8_t *)malloc(size);
+  if (!base) {
+    abort();
+  }
+  if (!blocks_.empty()) {
+    full_ += offset_;
+  }
+  blocks_.push_back(block_t{base, size});
+  offset_ = 0;
+}
+
+void arena_t::reserve(size_t bytes) {
+  if (capacity() >= bytes && blocks_.size() <= 1) {
+    return;
+  }
+  // only safe while nothing is allocated
+  if (used() == 0) {
+    free_blocks();
+    add_block(bytes);
+  }
+}
+
+void *arena_t::alloc(size_t bytes, size_t align) {
+  if (!blocks_.empty()) {
+    const block_t &b = blocks_.back();
+    // align the address rather than the offset, blocks are only malloc
+    // aligned
+    const uintptr_t p = uintptr_t(b.base) + offset_;
+    const size_t pad = (align - (p & (align - 1))) & (align - 1);
+    if (offset_ + pad + bytes <= b.size) {
+      offset_ += pad + bytes;
+      peak_ = std::max(peak_, used());
+      return (void *)(p + pad);
+    }
+  }
+  add_block(bytes + align);
+  return alloc(bytes, align);
+}
+
+void arena_t::reset() {
+  if (blocks_.size() > 1) {
+    // merge into one block big enough for the busiest frame so far, with
+    // room for alignment differences
+    free_blocks();
+    add_block(peak_ + peak_ / 4);
+  }
+  offset_ = 0;
+  full_ = 0;
+}
+
+size_t arena_t::capacity() const {
+  size_t size = 0;
+  for (const block_t &b : blocks_) {
+    size += b.size;
+  }
+  return size;
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// a linear allocator for transient memory that lives until the next reset,
+// normally the end of a frame. allocating bumps an offset and reset simply
+// rewinds it. when a frame overflows into more than one block they are
+// merged into a single block of the peak size on reset, so once warmed up
+// frames make no calls to malloc.
+struct arena_t {
+
+  arena_t();
+  ~arena_t();
+
+  arena_t(const arena_t &) = delete;
+  arena_t &operator=(const arena_t &) = delete;
+
+  // make sure the first block holds at least bytes
+  void reserve(size_t bytes);
+
+  void *alloc(size_t bytes, size_t align = alignof(std::max_align_t));
+
+  // uninitialized storage for n values of T
+  template <typename T>
+  T *alloc(size_t n) {
+    return (T *)alloc(n * sizeof(T), alignof(T));
+  }
+
+  // release everything allocated since the last reset
+  void reset();
+
+  // bytes handed out since the last reset
+  size_t used() const {
+    return full_ + offset_;
+  }
+
+  // the most bytes in use at once since init, for sizing reserve
+  size_t peak() const {
+    return peak_;
+  }
+
+  size_t capacity() const;
+
+protected:
+  struct block_t {
+    uint8_t *base;
+    size_t size;
+  };
+
+  void add_block(size_t bytes);
+  void free_blocks();
+
+  // allocation happens at the end of the last block
+  std::vector<block_t> blocks_;
+  size_t offset_;
+  // bytes used in the blocks before the last
+  size_t full_;
+  size_t peak_;
+};
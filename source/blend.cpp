@@ -0,0 +1,157 @@
+#include <cstdint>
+
+#include <emmintrin.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include "blend.h"
+
+namespace {
+
+// x / 255 for x in [0, 255 * 255], on 16bit lanes
+__m128i div255(__m128i x) {
+  x = _mm_add_epi16(x, _mm_set1_epi16(128));
+  return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+// scale all four channels of four pixels by k / 255
+__m128i scale4(__m128i c, __m128i k) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i lo = div255(_mm_mullo_epi16(_mm_unpacklo_epi8(c, zero), k));
+  const __m128i hi = div255(_mm_mullo_epi16(_mm_unpackhi_epi8(c, zero), k));
+  return _mm_packus_epi16(lo, hi);
+}
+
+// dst * (255 - src.a) / 255 + src for four pixels
+__m128i premul4(__m128i d, __m128i s) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i ff = _mm_set1_epi16(255);
+  __m128i slo = _mm_unpacklo_epi8(s, zero);
+  __m128i shi = _mm_unpackhi_epi8(s, zero);
+  // broadcast each pixels alpha over its four channels
+  slo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(slo, 0xff), 0xff);
+  shi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(shi, 0xff), 0xff);
+  const __m128i lo = div255(
+      _mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), _mm_sub_epi16(ff, slo)));
+  const __m128i hi = div255(
+      _mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), _mm_sub_epi16(ff, shi)));
+  return _mm_adds_epu8(_mm_packus_epi16(lo, hi), s);
+}
+
+#if defined(__AVX2__)
+__m256i div255(__m256i x) {
+  x = _mm256_add_epi16(x, _mm256_set1_epi16(128));
+  return _mm256_srli_epi16(_mm256_add_epi16(x, _mm256_srli_epi16(x, 8)), 8);
+}
+
+__m256i scale8(__m256i c, __m256i k) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i lo =
+      div255(_mm256_mullo_epi16(_mm256_unpacklo_epi8(c, zero), k));
+  const __m256i hi =
+      div255(_mm256_mullo_epi16(_mm256_unpackhi_epi8(c, zero), k));
+  return _mm256_packus_epi16(lo, hi);
+}
+
+// eight pixels at a time, unpack and pack work within 128bit lanes so the
+// pixel order is preserved
+__m256i premul8(__m256i d, __m256i s) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i ff = _mm256_set1_epi16(255);
+  __m256i slo = _mm256_unpacklo_epi8(s, zero);
+  __m256i shi = _mm256_unpackhi_epi8(s, zero);
+  slo = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(slo, 0xff), 0xff);
+  shi = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(shi, 0xff), 0xff);
+  const __m256i lo = div255(_mm256_mullo_epi16(
+      _mm256_unpacklo_epi8(d, zero), _mm256_sub_epi16(ff, slo)));
+  const __m256i hi = div255(_mm256_mullo_epi16(
+      _mm256_unpackhi_epi8(d, zero), _mm256_sub_epi16(ff, shi)));
+  return _mm256_adds_epu8(_mm256_packus_epi16(lo, hi), s);
+}
+#endif
+
+// load up to four pixels, zero filling the rest
+__m128i load_tail(const uint32_t *p, int32_t n) {
+  uint32_t tmp[4] = {0, 0, 0, 0};
+  for (int32_t i = 0; i < n; ++i) {
+    tmp[i] = p[i];
+  }
+  return _mm_loadu_si128((const __m128i *)tmp);
+}
+
+void store_tail(uint32_t *p, __m128i v, int32_t n) {
+  uint32_t tmp[4];
+  _mm_storeu_si128((__m128i *)tmp, v);
+  for (int32_t i = 0; i < n; ++i) {
+    p[i] = tmp[i];
+  }
+}
+
+} // namespace {}
+
+void blend_span_premul(uint32_t *dst, const uint32_t *src, int32_t n,
+                       uint32_t opacity) {
+  const bool scale = opacity < 255;
+  int32_t i = 0;
+#if defined(__AVX2__)
+  const __m256i k8 = _mm256_set1_epi16(int16_t(opacity));
+  for (; i + 8 <= n; i += 8) {
+    __m256i s = _mm256_loadu_si256((const __m256i *)(src + i));
+    if (scale) {
+      s = scale8(s, k8);
+    }
+    const __m256i d = _mm256_loadu_si256((const __m256i *)(dst + i));
+    _mm256_storeu_si256((__m256i *)(dst + i), premul8(d, s));
+  }
+#endif
+  const __m128i k = _mm_set1_epi16(int16_t(opacity));
+  for (; i + 4 <= n; i += 4) {
+    __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+    if (scale) {
+      s = scale4(s, k);
+    }
+    const __m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+    _mm_storeu_si128((__m128i *)(dst + i), premul4(d, s));
+  }
+  if (i < n) {
+    __m128i s = load_tail(src + i, n - i);
+    if (scale) {
+      s = scale4(s, k);
+    }
+    store_tail(dst + i, premul4(load_tail(dst + i, n - i), s), n - i);
+  }
+}
+
+void blend_span_add(uint32_t *dst, const uint32_t *src, int32_t n,
+                    uint32_t opacity) {
+  const bool scale = opacity < 255;
+  int32_t i = 0;
+#if defined(__AVX2__)
+  const __m256i k8 = _mm256_set1_epi16(int16_t(opacity));
+  for (; i + 8 <= n; i += 8) {
+    __m256i s = _mm256_loadu_si256((const __m256i *)(src + i));
+    if (scale) {
+      s = scale8(s, k8);
+    }
+    const __m256i d = _mm256_loadu_si256((const __m256i *)(dst + i));
+    _mm256_storeu_si256((__m256i *)(dst + i), _mm256_adds_epu8(d, s));
+  }
+#endif
+  const __m128i k = _mm_set1_epi16(int16_t(opacity));
+  for (; i + 4 <= n; i += 4) {
+    __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+    if (scale) {
+      s = scale4(s, k);
+    }
+    const __m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+    _mm_storeu_si128((__m128i *)(dst + i), _mm_adds_epu8(d, s));
+  }
+  if (i < n) {
+    __m128i s = load_tail(src + i, n - i);
+    if (scale) {
+      s = scale4(s, k);
+    }
+    store_tail(dst + i, _mm_adds_epu8(load_tail(dst + i, n - i), s), n - i);
+  }
+}
@@ -0,0 +1,24 @@
+#pragma once
+#include <cstdint>
+
+enum blend_mode_t {
+  // overwrite the destination
+  BLEND_NONE,
+  // dst = src + dst * (1 - src.a), src colour already multiplied by alpha
+  BLEND_PREMUL,
+  // dst = saturate(src + dst)
+  BLEND_ADD,
+};
+
+struct blend_t {
+  blend_mode_t mode;
+  // constant opacity [0, 255] applied to every channel of the source
+  uint32_t opacity;
+};
+
+// blend n 0xAARRGGBB source pixels onto dst
+void blend_span_premul(uint32_t *dst, const uint32_t *src, int32_t n,
+                       uint32_t opacity);
+
+void blend_span_add(uint32_t *dst, const uint32_t *src, int32_t n,
+                    uint32_t opacity);
@@ -0,0 +1,663 @@
+#include <cassert>
+#include <cmath>
+
+#include <algorithm>
+#include <array>
+
+#include "raster.h"
+#include "scanline.h"
+
+using namespace math;
+
+namespace {
+
+// a hidden batch's triangles are its own rather than expanded into list_
+const size_t not_expanded = ~size_t(0);
+
+void add_hidden(visbuf_t *vb, const std::array<vec4f_t, 3> &t, uint32_t id,
+                const std::array<uint32_t, 3> &index) {
+  draw_vis(vb, t, id, &index);
+}
+
+void add_hidden(hsr_t *hsr, const std::array<vec4f_t, 3> &t, uint32_t id,
+                const std::array<uint32_t, 3> &) {
+  draw_hsr(hsr, t, id);
+}
+
+// call fn with the polygon number and the vertex indices of every polygon
+// in a batch. those too long for the rasterizer are split into pieces that
+// share the first vertex and the polygon number.
+template <typename index_t, typename fn_t>
+void polygons(const draw_batch_t &batch, const index_t *index,
+              index_t restart, fn_t fn) {
+  std::array<uint32_t, max_poly_verts> p;
+  uint32_t prim = 0, n = 0;
+  for (uint32_t i = 0; i <= batch.num_index; ++i) {
+    if (i == batch.num_index || index[i] == restart) {
+      if (n >= 3) {
+        fn(prim, p.data(), n);
+      }
+      prim += (n != 0);
+      n = 0;
+      continue;
+    }
+    if (n == max_poly_verts) {
+      fn(prim, p.data(), n);
+      p[1] = p[n - 1];
+      n = 2;
+    }
+    p[n++] = index[i];
+  }
+}
+
+// call fn with the primitive number and vertex indices of every triangle
+// in a batch, in draw order. primitives are numbered as they are assembled
+// and degenerate strip and fan triangles are skipped. polygons are fanned,
+// their triangles sharing the polygon's number.
+template <typename index_t, typename fn_t>
+void assemble(const draw_batch_t &batch, const index_t *index,
+              index_t restart, fn_t fn) {
+  if (batch.topology == TOPOLOGY_POLYGON) {
+    polygons(batch, index, restart,
+             [&](uint32_t prim, const uint32_t *p, uint32_t n) {
+               for (uint32_t k = 2; k < n; ++k) {
+                 fn(prim, p[0], p[k - 1], p[k]);
+               }
+             });
+    return;
+  }
+  if (batch.topology == TOPOLOGY_LIST) {
+    for (uint32_t j = 0; j < batch.num_index / 3; ++j) {
+      const uint32_t i = batch.order ? batch.order[j] : j * 3;
+      fn(i / 3, index[i + 0], index[i + 1], index[i + 2]);
+    }
+    return;
+  }
+  const bool strip = batch.topology == TOPOLOGY_STRIP;
+  uint32_t prim = 0, n = 0, a = 0, b = 0;
+  for (uint32_t i = 0; i < batch.num_index; ++i) {
+    const uint32_t v = index[i];
+    if (batch.restart && v == restart) {
+      n = 0;
+      continue;
+    }
+    if (n++ == 0) {
+      a = v;
+      continue;
+    }
+    if (n > 2 && a != b && b != v && a != v) {
+      // odd strip triangles are flipped to keep the winding
+      if (strip && (n & 1) == 0) {
+        fn(prim++, b, a, v);
+      } else {
+        fn(prim++, a, b, v);
+      }
+    }
+    if (strip && n > 2) {
+      a = b;
+    }
+    b = v;
+  }
+}
+
+// screen area covered by the vertices a batch uses, clamped to the target
+template <typename index_t>
+rect_t batch_bounds(const draw_batch_t &batch, const index_t *index,
+                    index_t restart, const framebuffer_t &fb) {
+  const bool skip = batch.restart || batch.topology == TOPOLOGY_POLYGON;
+  float x0 = 1e30f, y0 = 1e30f, x1 = -1e30f, y1 = -1e30f;
+  for (uint32_t i = 0; i < batch.num_index; ++i) {
+    if (skip && index[i] == restart) {
+      continue;
+    }
+    const vec4f_t &v = batch.screen[index[i]];
+    x0 = std::min(x0, v.x);
+    y0 = std::min(y0, v.y);
+    x1 = std::max(x1, v.x);
+    y1 = std::max(y1, v.y);
+  }
+  if (x0 > x1) {
+    return rect_t{0, 0, 0, 0};
+  }
+  const float w = float(fb.width), h = float(fb.height);
+  return rect_t{
+    int32_t(std::max(floorf(x0), 0.f)),
+    int32_t(std::max(floorf(y0), 0.f)),
+    int32_t(std::min(ceilf(x1) + 1.f, w)),
+    int32_t(std::min(ceilf(y1) + 1.f, h)),
+  };
+}
+
+rect_t batch_bounds(const draw_batch_t &batch, const framebuffer_t &fb) {
+  if (batch.index16) {
+    return batch_bounds(batch, batch.index16,
+                        packed_mesh_t::restart_index16, fb);
+  }
+  return batch_bounds(batch, batch.index, restart_index, fb);
+}
+
+bool is_empty(const rect_t &r) {
+  return r.x0 >= r.x1 || r.y0 >= r.y1;
+}
+
+void grow(rect_t &r, const rect_t &by) {
+  if (is_empty(by)) {
+    return;
+  }
+  if (is_empty(r)) {
+    r = by;
+    return;
+  }
+  r = rect_t{std::min(r.x0, by.x0), std::min(r.y0, by.y0),
+             std::max(r.x1, by.x1), std::max(r.y1, by.y1)};
+}
+
+// the whole of a target
+rect_t bounds(const framebuffer_t &fb) {
+  return rect_t{0, 0, int32_t(fb.width), int32_t(fb.height)};
+}
+
+// r clipped to a target
+rect_t clip(const rect_t &r, const framebuffer_t &fb) {
+  return rect_t{std::max(r.x0, 0), std::max(r.y0, 0),
+                std::min(r.x1, int32_t(fb.width)),
+                std::min(r.y1, int32_t(fb.height))};
+}
+
+bool overlaps(const rect_t &a, const rect_t &b) {
+  return a.x0 < b.x1 && b.x0 < a.x1 && a.y0 < b.y1 && b.y0 < a.y1;
+}
+
+// true when no two views draw into the same target of their own, as those
+// are drawn in parallel. views into fb share it and are drawn in order.
+bool distinct_targets(const view_t *views, uint32_t num_views,
+                      const framebuffer_t *fb) {
+  for (uint32_t i = 0; i < num_views; ++i) {
+    const framebuffer_t *t = views[i].target;
+    if (!t || t == fb) {
+      continue;
+    }
+    for (uint32_t j = 0; j < i; ++j) {
+      if (views[j].target == t) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool same_state(const draw_state_t &a, const draw_state_t &b) {
+  return a.shade == b.shade && a.blend.mode == b.blend.mode &&
+         a.blend.opacity == b.blend.opacity && a.texture == b.texture &&
+         a.filter == b.filter && a.rate == b.rate;
+}
+
+template <typename fn_t>
+void assemble(const draw_batch_t &batch, fn_t fn) {
+  if (batch.index16) {
+    assemble(batch, batch.index16, packed_mesh_t::restart_index16, fn);
+  } else {
+    assemble(batch, batch.index, restart_index, fn);
+  }
+}
+
+template <typename fn_t>
+void polygons(const draw_batch_t &batch, fn_t fn) {
+  if (batch.index16) {
+    polygons(batch, batch.index16, packed_mesh_t::restart_index16, fn);
+  } else {
+    polygons(batch, batch.index, restart_index, fn);
+  }
+}
+
+// draw a batch's polygons whole rather than as fans
+template <typename target_t>
+void draw_polygons(target_t *target, const draw_batch_t &batch,
+                   const draw_state_t &state) {
+  std::array<vec4f_t, max_poly_verts> post;
+  std::array<uint32_t, max_poly_verts> rgb;
+  std::array<vec2f_t, max_poly_verts> uv;
+  // polygons split into fans share edges with their neighbours
+  edge_scope_t edges;
+  polygons(batch, [&](uint32_t prim, const uint32_t *p, uint32_t n) {
+    for (uint32_t k = 0; k < n; ++k) {
+      post[k] = batch.screen[p[k]];
+    }
+    switch (state.shade) {
+    case SHADE_FLAT:
+      draw_poly(target, post.data(), n, batch.tri_rgb[prim], state.blend,
+                p);
+      break;
+    case SHADE_GOURAUD:
+      for (uint32_t k = 0; k < n; ++k) {
+        rgb[k] = batch.rgb[p[k]];
+      }
+      draw_poly_gouraud(target, post.data(), n, rgb.data(), state.blend, p);
+      break;
+    case SHADE_TEXTURE:
+      for (uint32_t k = 0; k < n; ++k) {
+        uv[k] = batch.uv[p[k]];
+      }
+      draw_poly_tex(target, post.data(), n, uv.data(), *state.texture,
+                    state.filter, state.blend, p);
+      break;
+    }
+  });
+}
+
+} // namespace {}
+
+render_context_t::render_context_t()
+  : fb_(nullptr)
+  , msaa_(nullptr)
+  , clear_(0)
+  , cleared_(false)
+  , hidden_(HIDDEN_NONE)
+  , jobs_(nullptr)
+  , num_ids_(0)
+  , coherent_(false)
+  , deferred_(false)
+  , target_{nullptr, 0, 0, PIXEL_RGBA8, LAYOUT_LINEAR, false, 0}
+{
+}
+
+void render_context_t::set_jobs(jobs_t *jobs) {
+  jobs_ = jobs;
+}
+
+void render_context_t::set_hidden(hidden_mode_t mode) {
+  if (fb_) {
+    resolve_hidden();
+  }
+  hidden_ = mode;
+}
+
+void render_context_t::set_coherent(bool enable) {
+  coherent_ = enable;
+}
+
+void render_context_t::begin(framebuffer_t *fb, uint32_t clear_rgb,
+                             msaa_target_t *msaa) {
+  fb_ = fb;
+  msaa_ = msaa;
+  clear_ = clear_rgb;
+  cleared_ = false;
+  pending_.clear();
+  list_.clear();
+  fan_rgb_.clear();
+  num_ids_ = 0;
+  fb_->checker ^= 1;
+  if (msaa_) {
+    msaa_->clear(clear_rgb);
+  }
+  // the hidden surface passes write every pixel themselves
+  deferred_ = coherent_ && !msaa_ && hidden_ == HIDDEN_NONE;
+  if (!deferred_ && !cache_.empty()) {
+    // a coherent frame leaves more than last frame's tiles on screen
+    fb_->clear(clear_rgb);
+    cache_.clear();
+    target_.fb = nullptr;
+  }
+}
+
+void render_context_t::clear(bool checker) {
+  if (cleared_) {
+    return;
+  }
+  cleared_ = true;
+  if (checker) {
+    // the other half holds last frame's pixels, so none can be skipped
+    fb_->clear_checker(clear_);
+    return;
+  }
+  // only the tiles drawn last frame need to be cleared
+  fb_->dirty.last_rects(rects_);
+  fb_->clear(clear_, rects_);
+}
+
+void render_context_t::draw(const draw_batch_t &batch,
+                            const draw_state_t &state) {
+  if (!fb_) {
+    return;
+  }
+
+  if (deferred_) {
+    draws_.push_back(deferred_t{batch, state, rect_t{0, 0, 0, 0}});
+    return;
+  }
+
+  // both only resolve the nearest opaque surface
+  if (!msaa_ && state.blend.mode == BLEND_NONE) {
+    switch (hidden_) {
+    case HIDDEN_VISBUF:
+      if (vis_.width() != fb_->width || vis_.height() != fb_->height) {
+        vis_.init(fb_->width, fb_->height);
+      } else if (pending_.empty()) {
+        vis_.clear();
+      }
+      draw_hidden(vis_, batch, state);
+      return;
+    case HIDDEN_SCANLINE:
+      if (hsr_.width() != fb_->width || hsr_.height() != fb_->height) {
+        hsr_.init(fb_->width, fb_->height);
+      } else if (pending_.empty()) {
+        hsr_.clear();
+      }
+      draw_hidden(hsr_, batch, state);
+      return;
+    default:
+      break;
+    }
+  }
+
+  // anything else is drawn over the opaque surfaces so far
+  resolve_hidden();
+
+  // blending is not supported into the multisample target
+  if (msaa_) {
+    draw_forward(msaa_, batch, state);
+  } else {
+    clear(state.rate == RATE_CHECKER && state.blend.mode == BLEND_NONE);
+    fb_->rate = state.rate;
+    draw_forward(fb_, batch, state);
+  }
+}
+
+void render_context_t::flush_deferred() {
+  deferred_ = false;
+  // a coherent frame leaves more than last frame's tiles on screen
+  fb_->clear(clear_);
+  cleared_ = true;
+  cache_.clear();
+  target_.fb = nullptr;
+  for (const deferred_t &d : draws_) {
+    fb_->rate = (d.state.rate == RATE_CHECKER) ? RATE_1X1 : d.state.rate;
+    draw_forward(fb_, d.batch, d.state);
+  }
+  draws_.clear();
+}
+
+void render_context_t::draw_views(const draw_batch_t &batch,
+                                  const draw_state_t &state,
+                                  const view_t *views, uint32_t num_views) {
+  // views go straight into framebuffers, anything drawn into the
+  // multisample target or by a hidden surface pass would cover them
+  assert(!msaa_ && hidden_ == HIDDEN_NONE);
+  assert(distinct_targets(views, num_views, fb_));
+  if (!fb_ || msaa_ || hidden_ != HIDDEN_NONE) {
+    return;
+  }
+  if (deferred_) {
+    flush_deferred();
+  }
+
+  // targets of their own are cleared, leaving a checkerboard nothing to
+  // fill in from
+  framebuffer_t *shared = fb_;
+  const shading_rate_t own_rate =
+      (state.rate == RATE_CHECKER) ? RATE_1X1 : state.rate;
+  const auto draw_own = [=](uint32_t i0, uint32_t i1) {
+    for (uint32_t i = i0; i < i1; ++i) {
+      framebuffer_t *target = views[i].target;
+      if (!target || target == shared) {
+        continue;
+      }
+      draw_batch_t view = batch;
+      view.screen = views[i].screen;
+      target->clear(clear_);
+      target->rate = own_rate;
+      target->scissor = clip(views[i].viewport, *target);
+      draw_forward(target, view, state);
+      target->scissor = bounds(*target);
+    }
+  };
+  task_t *own = nullptr;
+  if (jobs_) {
+    own = jobs_->parallel_for(0, num_views, 1, draw_own);
+  } else {
+    draw_own(0, num_views);
+  }
+
+  // meanwhile the views sharing the context's target are drawn in order
+  clear(state.rate == RATE_CHECKER && state.blend.mode == BLEND_NONE);
+  fb_->rate = state.rate;
+  for (uint32_t i = 0; i < num_views; ++i) {
+    if (views[i].target && views[i].target != fb_) {
+      continue;
+    }
+    draw_batch_t view = batch;
+    view.screen = views[i].screen;
+    fb_->scissor = clip(views[i].viewport, *fb_);
+    draw_forward(fb_, view, state);
+  }
+  fb_->scissor = bounds(*fb_);
+
+  if (own) {
+    jobs_->wait(own);
+  }
+}
+
+void render_context_t::end() {
+  if (!fb_) {
+    return;
+  }
+  resolve_hidden();
+  if (msaa_) {
+    msaa_->resolve(*fb_);
+    fb_->dirty.mark_all();
+  } else if (deferred_) {
+    draw_coherent();
+  } else {
+    clear(false);
+  }
+  fb_ = nullptr;
+  msaa_ = nullptr;
+}
+
+void render_context_t::draw_coherent() {
+  const target_key_t target = {fb_,         fb_->width,
+                               fb_->height, fb_->format,
+                               fb_->layout, !fb_->depth.empty(),
+                               clear_};
+  const bool valid = target.fb == target_.fb &&
+                     target.width == target_.width &&
+                     target.height == target_.height &&
+                     target.format == target_.format &&
+                     target.layout == target_.layout &&
+                     target.depth == target_.depth &&
+                     target.clear == target_.clear &&
+                     fb_->rate_map.size() == rate_map_.size();
+
+  // the area where anything may differ from last frame. unchanged batches
+  // keep last frame's bounds rather than walking their vertices again.
+  rect_t region = {0, 0, 0, 0};
+  for (size_t i = 0; i < draws_.size(); ++i) {
+    deferred_t &d = draws_[i];
+    const cached_t *old = (valid && i < cache_.size()) ? &cache_[i] : nullptr;
+    if (old && d.batch.key && d.batch.key == old->key &&
+        same_state(d.state, old->state)) {
+      d.bounds = old->bounds;
+      continue;
+    }
+    d.bounds = batch_bounds(d.batch, *fb_);
+    grow(region, d.bounds);
+    if (old) {
+      grow(region, old->bounds);
+    }
+  }
+  for (size_t i = draws_.size(); i < cache_.size(); ++i) {
+    grow(region, cache_[i].bounds);
+  }
+  if (valid) {
+    // tiles shaded at another rate than last frame
+    const int32_t size = int32_t(framebuffer_t::tile_size);
+    for (size_t i = 0; i < rate_map_.size(); ++i) {
+      if (fb_->rate_map[i] != rate_map_[i]) {
+        const int32_t x = int32_t(i % fb_->tiles_x) * size;
+        const int32_t y = int32_t(i / fb_->tiles_x) * size;
+        grow(region, clip(rect_t{x, y, x + size, y + size}, *fb_));
+      }
+    }
+  } else {
+    region = rect_t{0, 0, int32_t(fb_->width), int32_t(fb_->height)};
+  }
+
+  if (!is_empty(region)) {
+    // repaint the region from scratch in submission order
+    fb_->clear(clear_, {region});
+    fb_->dirty.mark(region.x0, region.y0, region.x1, region.y1);
+    fb_->scissor = region;
+    for (const deferred_t &d : draws_) {
+      if (overlaps(d.bounds, region)) {
+        // the region was cleared in full, so nothing is left to fill in
+        fb_->rate =
+            (d.state.rate == RATE_CHECKER) ? RATE_1X1 : d.state.rate;
+        draw_forward(fb_, d.batch, d.state);
+      }
+    }
+    fb_->scissor = bounds(*fb_);
+  }
+
+  cache_.resize(draws_.size());
+  for (size_t i = 0; i < draws_.size(); ++i) {
+    cache_[i] = cached_t{draws_[i].batch.key, draws_[i].state,
+                         draws_[i].bounds};
+  }
+  target_ = target;
+  rate_map_ = fb_->rate_map;
+  draws_.clear();
+}
+
+template <typename target_t>
+void render_context_t::draw_forward(target_t *target,
+                                    const draw_batch_t &batch,
+                                    const draw_state_t &state) {
+  if (batch.topology == TOPOLOGY_POLYGON) {
+    draw_polygons(target, batch, state);
+    return;
+  }
+  const vec4f_t *screen = batch.screen;
+
+  // triangles sharing an edge share its setup
+  edge_scope_t edges;
+  std::array<vec4f_t, 3> post;
+  assemble(batch, [&](uint32_t prim, uint32_t i0, uint32_t i1, uint32_t i2) {
+    const std::array<uint32_t, 3> index = {i0, i1, i2};
+    post[0] = screen[i0];
+    post[1] = screen[i1];
+    post[2] = screen[i2];
+
+    switch (state.shade) {
+    case SHADE_FLAT:
+      draw_tri(target, post, batch.tri_rgb[prim], state.blend, &index);
+      break;
+    case SHADE_GOURAUD: {
+      const std::array<uint32_t, 3> rgb = {
+        batch.rgb[i0],
+        batch.rgb[i1],
+        batch.rgb[i2],
+      };
+      draw_tri_gouraud(target, post, rgb, state.blend, &index);
+    } break;
+    case SHADE_TEXTURE: {
+      const std::array<vec2f_t, 3> uv = {
+        batch.uv[i0],
+        batch.uv[i1],
+        batch.uv[i2],
+      };
+      draw_tri_tex(target, post, uv, *state.texture, state.filter,
+                   state.blend, &index);
+    } break;
+    }
+  });
+}
+
+// rasterize a batch's triangle ids, shading waits for resolve_hidden so
+// later batches can still hide this one
+template <typename source_t>
+void render_context_t::draw_hidden(source_t &src, const draw_batch_t &batch,
+                                   const draw_state_t &state) {
+  hidden_t h = {{{batch.screen, batch.index}, num_ids_, batch.tri_rgb,
+                 nullptr, nullptr, nullptr, state.filter},
+                not_expanded, not_expanded};
+  switch (state.shade) {
+  case SHADE_FLAT:
+    break;
+  case SHADE_GOURAUD:
+    h.batch.rgb = batch.rgb;
+    break;
+  case SHADE_TEXTURE:
+    h.batch.uv = batch.uv;
+    h.batch.tex = state.texture;
+    break;
+  }
+
+  // ids index the shading pass's triangle list
+  const uint32_t *list = batch.index;
+  uint32_t num_index = batch.num_index;
+  if (batch.topology != TOPOLOGY_LIST || batch.index16) {
+    // a polygon's flat colour is repeated for each triangle of its fan
+    const bool poly = batch.topology == TOPOLOGY_POLYGON;
+    const bool flat = poly && state.shade == SHADE_FLAT;
+    h.list = list_.size();
+    if (flat) {
+      h.rgb = fan_rgb_.size();
+    }
+    assemble(batch, [&](uint32_t prim, uint32_t i0, uint32_t i1, uint32_t i2) {
+      list_.insert(list_.end(), {i0, i1, i2});
+      if (flat) {
+        fan_rgb_.push_back(batch.tri_rgb[prim]);
+      }
+    });
+    list = list_.data() + h.list;
+    num_index = uint32_t(list_.size() - h.list);
+  }
+
+  const uint32_t num_tris = num_index / 3;
+  edge_scope_t edges;
+  std::array<vec4f_t, 3> post;
+  for (uint32_t j = 0; j < num_tris; ++j) {
+    const std::array<uint32_t, 3> index = {list[j * 3], list[j * 3 + 1],
+                                           list[j * 3 + 2]};
+    post[0] = batch.screen[index[0]];
+    post[1] = batch.screen[index[1]];
+    post[2] = batch.screen[index[2]];
+    add_hidden(&src, post, num_ids_ + j, index);
+  }
+  num_ids_ += num_tris;
+  pending_.push_back(h);
+}
+
+void render_context_t::resolve_hidden() {
+  if (pending_.empty()) {
+    return;
+  }
+  // the expanded lists are complete, so can be pointed into
+  batches_.clear();
+  for (const hidden_t &h : pending_) {
+    vis_batch_t b = h.batch;
+    if (h.list != not_expanded) {
+      b.mesh.index = list_.data() + h.list;
+    }
+    if (h.rgb != not_expanded) {
+      b.tri_rgb = fan_rgb_.data() + h.rgb;
+    }
+    batches_.push_back(b);
+  }
+
+  // before anything else is drawn every pixel is written, so the target
+  // needs no clear. after it, only the covered pixels are.
+  const bool fill = !cleared_;
+  const uint32_t n = uint32_t(batches_.size());
+  if (hidden_ == HIDDEN_VISBUF) {
+    shade_vis(fb_, vis_, batches_.data(), n, clear_, fill, jobs_);
+  } else {
+    shade_vis(fb_, hsr_, batches_.data(), n, clear_, fill, jobs_);
+  }
+  cleared_ = true;
+
+  pending_.clear();
+  list_.clear();
+  fan_rgb_.clear();
+  num_ids_ = 0;
+}
@@ -0,0 +1,70 @@
+#include <algorithm>
+
+#include "dirty.h"
+
+void dirty_t::init(uint32_t width, uint32_t height) {
+  width_ = width;
+  height_ = height;
+  tiles_x_ = (width + tile_size - 1) >> tile_shift;
+  tiles_y_ = (height + tile_size - 1) >> tile_shift;
+  cur_.assign(tiles_x_ * tiles_y_, 1);
+  last_.assign(tiles_x_ * tiles_y_, 1);
+}
+
+void dirty_t::mark_all() {
+  std::fill(cur_.begin(), cur_.end(), 1);
+}
+
+void dirty_t::next_frame() {
+  cur_.swap(last_);
+  std::fill(cur_.begin(), cur_.end(), 0);
+}
+
+void dirty_t::last_rects(std::vector<rect_t> &out) const {
+  rects(false, out);
+}
+
+void dirty_t::changed_rects(std::vector<rect_t> &out) const {
+  rects(true, out);
+}
+
+void dirty_t::rects(bool with_cur, std::vector<rect_t> &out) const {
+  out.clear();
+  for (uint32_t ty = 0; ty < tiles_y_; ++ty) {
+    const size_t row_start = out.size();
+    const uint32_t base = ty * tiles_x_;
+    for (uint32_t tx = 0; tx < tiles_x_;) {
+      const auto set = [&](uint32_t x) {
+        return last_[base + x] || (with_cur && cur_[base + x]);
+      };
+      if (!set(tx)) {
+        ++tx;
+        continue;
+      }
+      uint32_t end = tx;
+      while (end < tiles_x_ && set(end)) {
+        ++end;
+      }
+      const rect_t r = {
+        int32_t(tx << tile_shift),
+        int32_t(ty << tile_shift),
+        std::min(int32_t(end << tile_shift), int32_t(width_)),
+        std::min(int32_t((ty + 1) << tile_shift), int32_t(height_)),
+      };
+      // extend a matching run ending on the previous row downwards
+      bool merged = false;
+      for (size_t i = 0; i < row_start; ++i) {
+        rect_t &a = out[i];
+        if (a.x0 == r.x0 && a.x1 == r.x1 && a.y1 == r.y0) {
+          a.y1 = r.y1;
+          merged = true;
+          break;
+        }
+      }
+      if (!merged) {
+        out.push_back(r);
+      }
+      tx = end;
+    }
+  }
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+// a screen rectangle, max is exclusive
+struct rect_t {
+  int32_t x0, y0, x1, y1;
+};
+
+// tracks which screen tiles were drawn to this frame and last frame
+struct dirty_t {
+
+  // tiles are 32x32 pixels
+  static const uint32_t tile_shift = 5;
+  static const uint32_t tile_size = 1u << tile_shift;
+
+  // everything starts dirty so the first frame is fully cleared and shown
+  void init(uint32_t width, uint32_t height);
+
+  // mark the tiles overlapping a pixel rectangle as drawn this frame
+  void mark(int32_t x0, int32_t y0, int32_t x1, int32_t y1) {
+    x0 = x0 < 0 ? 0 : x0;
+    y0 = y0 < 0 ? 0 : y0;
+    x1 = x1 > int32_t(width_) ? int32_t(width_) : x1;
+    y1 = y1 > int32_t(height_) ? int32_t(height_) : y1;
+    if (x0 >= x1 || y0 >= y1) {
+      return;
+    }
+    const uint32_t tx0 = uint32_t(x0) >> tile_shift;
+    const uint32_t ty0 = uint32_t(y0) >> tile_shift;
+    const uint32_t tx1 = uint32_t(x1 - 1) >> tile_shift;
+    const uint32_t ty1 = uint32_t(y1 - 1) >> tile_shift;
+    for (uint32_t ty = ty0; ty <= ty1; ++ty) {
+      uint8_t *t = cur_.data() + ty * tiles_x_;
+      for (uint32_t tx = tx0; tx <= tx1; ++tx) {
+        t[tx] = 1;
+      }
+    }
+  }
+
+  void mark_all();
+
+  // rectangles covering the tiles drawn last frame
+  void last_rects(std::vector<rect_t> &out) const;
+
+  // rectangles covering the tiles drawn this frame or last frame, these are
+  // the only parts of the screen that can have changed
+  void changed_rects(std::vector<rect_t> &out) const;
+
+  // this frame becomes last frame
+  void next_frame();
+
+protected:
+  void rects(bool with_cur, std::vector<rect_t> &out) const;
+
+  uint32_t width_, height_;
+  uint32_t tiles_x_, tiles_y_;
+  std::vector<uint8_t> cur_, last_;
+};
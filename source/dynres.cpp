@@ -0,0 +1,94 @@
+#include <algorithm>
+#include <cmath>
+
+#include "dynres.h"
+
+namespace {
+
+// render sizes are kept to a multiple of this
+const uint32_t size_step = 8;
+
+// aim a little under the budget so noise does not push us over it
+const float headroom = .9f;
+
+// only grow once the frame time falls this far under the budget
+const float grow_below = .75f;
+
+// weight of the newest frame in the smoothed time
+const float smoothing = .2f;
+
+// frames ignored after a change while the new size settles
+const uint32_t settle_frames = 4;
+
+uint32_t round_size(float v, uint32_t limit) {
+  const uint32_t s = (uint32_t(v) / size_step) * size_step;
+  return std::min(std::max(s, size_step), limit);
+}
+
+} // namespace {}
+
+dynres_t::dynres_t()
+  : out_w_(0)
+  , out_h_(0)
+  , width_(0)
+  , height_(0)
+  , budget_(0.f)
+  , min_scale_(1.f)
+  , max_scale_(1.f)
+  , scale_(1.f)
+  , average_(0.f)
+  , settle_(0)
+{
+}
+
+void dynres_t::init(uint32_t out_w, uint32_t out_h, float budget_ms,
+                    float min_scale, float max_scale) {
+  out_w_ = out_w;
+  out_h_ = out_h;
+  budget_ = budget_ms;
+  min_scale_ = min_scale;
+  max_scale_ = std::max(min_scale, max_scale);
+  scale_ = max_scale_;
+  average_ = 0.f;
+  settle_ = 0;
+  resize();
+}
+
+void dynres_t::resize() {
+  width_ = round_size(float(out_w_) * scale_, out_w_);
+  height_ = round_size(float(out_h_) * scale_, out_h_);
+}
+
+bool dynres_t::update(float frame_ms) {
+  if (!enabled()) {
+    return false;
+  }
+  average_ = (average_ > 0.f)
+                 ? average_ + (frame_ms - average_) * smoothing
+                 : frame_ms;
+  if (settle_) {
+    --settle_;
+    return false;
+  }
+
+  // hysteresis, leave the scale alone while comfortably within budget
+  if (average_ <= budget_ && average_ >= budget_ * grow_below) {
+    return false;
+  }
+
+  // limit each step so one slow frame cannot collapse the resolution
+  const float step =
+      std::min(std::max(sqrtf(budget_ * headroom / average_), .7f), 1.15f);
+  const float next = std::min(std::max(scale_ * step, min_scale_), max_scale_);
+
+  const uint32_t w = width_, h = height_;
+  scale_ = next;
+  resize();
+  if (w == width_ && h == height_) {
+    return false;
+  }
+  // predict the new cost from the change in pixel count
+  average_ *= float(width_ * height_) / float(w * h);
+  settle_ = settle_frames;
+  return true;
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <cstdint>
+
+// picks the render resolution each frame so the frame time stays under a
+// budget. raster cost follows the pixel count, so the scale on each axis
+// moves with the square root of the budget over the measured time. the
+// render target is then upscaled to the output size when presented.
+struct dynres_t {
+
+  dynres_t();
+
+  // output size, a budget of 0 leaves the scale at max_scale
+  void init(uint32_t out_w, uint32_t out_h, float budget_ms,
+            float min_scale = .25f, float max_scale = 1.f);
+
+  // feed the time taken by the last frame, returns true when the render
+  // size changed
+  bool update(float frame_ms);
+
+  bool enabled() const {
+    return budget_ > 0.f;
+  }
+
+  float scale() const {
+    return scale_;
+  }
+
+  // render size for the current scale
+  uint32_t width() const {
+    return width_;
+  }
+
+  uint32_t height() const {
+    return height_;
+  }
+
+protected:
+  void resize();
+
+  uint32_t out_w_, out_h_;
+  uint32_t width_, height_;
+  float budget_;
+  float min_scale_, max_scale_;
+  float scale_;
+  // smoothed frame time, 0 until the first frame
+  float average_;
+  // frames to wait after a change before acting again
+  uint32_t settle_;
+};
@@ -0,0 +1,555 @@
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+
+#include <algorithm>
+
+#include <emmintrin.h>
+
+#include "framebuffer.h"
+
+namespace {
+
+uint32_t index_of(uint32_t rgb) {
+  return ((rgb >> 9) & 0x7c00) | ((rgb >> 6) & 0x03e0) | ((rgb >> 3) & 0x1f);
+}
+
+// nearest palette entries of n 32bit pixels
+void pack_index8(uint8_t *dst, const uint32_t *src, uint32_t n,
+                 const uint8_t *inverse) {
+  for (uint32_t i = 0; i < n; ++i) {
+    dst[i] = inverse[index_of(src[i])];
+  }
+}
+
+uint32_t rgb565(uint32_t c) {
+  return ((c >> 8) & 0xf800) | ((c >> 5) & 0x07e0) | ((c >> 3) & 0x001f);
+}
+
+uint32_t rgba8(uint32_t c) {
+  const uint32_t r = (c >> 11) & 0x1f, g = (c >> 5) & 0x3f, b = c & 0x1f;
+  return 0xff000000 | (((r << 3) | (r >> 2)) << 16) |
+         (((g << 2) | (g >> 4)) << 8) | ((b << 3) | (b >> 2));
+}
+
+} // namespace {}
+
+void pack_rgb565(uint16_t *dst, const uint32_t *src, uint32_t n) {
+  uint32_t i = 0;
+  const __m128i mr = _mm_set1_epi32(0xf800);
+  const __m128i mg = _mm_set1_epi32(0x07e0);
+  const __m128i mb = _mm_set1_epi32(0x001f);
+  const __m128i bias = _mm_set1_epi32(0x8000);
+  const __m128i unbias = _mm_set1_epi16(int16_t(0x8000));
+  for (; i + 8 <= n; i += 8) {
+    __m128i a = _mm_loadu_si128((const __m128i *)(src + i));
+    __m128i b = _mm_loadu_si128((const __m128i *)(src + i + 4));
+    a = _mm_or_si128(
+        _mm_or_si128(_mm_and_si128(_mm_srli_epi32(a, 8), mr),
+                     _mm_and_si128(_mm_srli_epi32(a, 5), mg)),
+        _mm_and_si128(_mm_srli_epi32(a, 3), mb));
+    b = _mm_or_si128(
+        _mm_or_si128(_mm_and_si128(_mm_srli_epi32(b, 8), mr),
+                     _mm_and_si128(_mm_srli_epi32(b, 5), mg)),
+        _mm_and_si128(_mm_srli_epi32(b, 3), mb));
+    // there is no unsigned 32 to 16 pack in SSE2 so bias into signed range
+    const __m128i p = _mm_packs_epi32(_mm_sub_epi32(a, bias),
+                                      _mm_sub_epi32(b, bias));
+    _mm_storeu_si128((__m128i *)(dst + i), _mm_xor_si128(p, unbias));
+  }
+  for (; i < n; ++i) {
+    dst[i] = uint16_t(rgb565(src[i]));
+  }
+}
+
+void unpack_rgb565(uint32_t *dst, const uint16_t *src, uint32_t n) {
+  uint32_t i = 0;
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i m5 = _mm_set1_epi32(0x1f);
+  const __m128i m6 = _mm_set1_epi32(0x3f);
+  const __m128i alpha = _mm_set1_epi32(int32_t(0xff000000));
+  for (; i + 8 <= n; i += 8) {
+    const __m128i c = _mm_loadu_si128((const __m128i *)(src + i));
+    for (int half = 0; half < 2; ++half) {
+      const __m128i p =
+          half ? _mm_unpackhi_epi16(c, zero) : _mm_unpacklo_epi16(c, zero);
+      const __m128i r = _mm_and_si128(_mm_srli_epi32(p, 11), m5);
+      const __m128i g = _mm_and_si128(_mm_srli_epi32(p, 5), m6);
+      const __m128i b = _mm_and_si128(p, m5);
+      // replicate the high bits into the low bits
+      const __m128i r8 =
+          _mm_or_si128(_mm_slli_epi32(r, 3), _mm_srli_epi32(r, 2));
+      const __m128i g8 =
+          _mm_or_si128(_mm_slli_epi32(g, 2), _mm_srli_epi32(g, 4));
+      const __m128i b8 =
+          _mm_or_si128(_mm_slli_epi32(b, 3), _mm_srli_epi32(b, 2));
+      const __m128i out = _mm_or_si128(
+          _mm_or_si128(alpha, _mm_slli_epi32(r8, 16)),
+          _mm_or_si128(_mm_slli_epi32(g8, 8), b8));
+      _mm_storeu_si128((__m128i *)(dst + i + half * 4), out);
+    }
+  }
+  for (; i < n; ++i) {
+    dst[i] = rgba8(src[i]);
+  }
+}
+
+void framebuffer_t::init(uint32_t w, uint32_t h, pixel_format_t fmt,
+                         fb_layout_t lay) {
+  width = w;
+  height = h;
+  format = fmt;
+  layout = lay;
+  pitch = w * pixel_size(fmt);
+  // whole tiles, padding the right and bottom edges
+  tiles_x = (w + tile_size - 1) >> tile_shift;
+  const uint32_t tiles_y = (h + tile_size - 1) >> tile_shift;
+  pixels.assign((lay == LAYOUT_TILED)
+                    ? ((tiles_x * tiles_y) << (tile_shift * 2)) *
+                          pixel_size(fmt)
+                    : pitch * h);
+  if (!depth.empty()) {
+    depth.assign(w * h, 0.f);
+  }
+  if (!rate_map.empty()) {
+    rate_map.assign(tiles_x * tiles_y, RATE_1X1);
+  }
+  dirty.init(w, h);
+  scissor = rect_t{0, 0, int32_t(w), int32_t(h)};
+  if (fmt == PIXEL_INDEX8 && palette.empty()) {
+    // default to a 3:3:2 palette
+    uint32_t pal[256];
+    for (uint32_t i = 0; i < 256; ++i) {
+      const uint32_t r = (i >> 5) & 7, g = (i >> 2) & 7, b = i & 3;
+      pal[i] = 0xff000000 | (((r * 255) / 7) << 16) | (((g * 255) / 7) << 8) |
+               ((b * 255) / 3);
+    }
+    set_palette(pal, 256);
+  }
+}
+
+void framebuffer_t::set_palette(const uint32_t *rgb, uint32_t count) {
+  palette.assign(rgb, rgb + std::min<uint32_t>(count, 256));
+  palette.resize(256, 0xff000000);
+  // nearest palette entry for every 15bit colour
+  inverse.resize(1 << 15);
+  for (uint32_t c = 0; c < (1u << 15); ++c) {
+    const int32_t r = ((c >> 10) & 0x1f) << 3;
+    const int32_t g = ((c >> 5) & 0x1f) << 3;
+    const int32_t b = (c & 0x1f) << 3;
+    int32_t best = 0x7fffffff;
+    for (uint32_t i = 0; i < count && i < 256; ++i) {
+      const int32_t dr = r - int32_t((palette[i] >> 16) & 0xff);
+      const int32_t dg = g - int32_t((palette[i] >> 8) & 0xff);
+      const int32_t db = b - int32_t(palette[i] & 0xff);
+      const int32_t d = dr * dr + dg * dg + db * db;
+      if (d < best) {
+        best = d;
+        inverse[c] = uint8_t(i);
+      }
+    }
+  }
+}
+
+uint32_t framebuffer_t::pack(uint32_t rgb) const {
+  switch (format) {
+  case PIXEL_RGB565:
+    return rgb565(rgb);
+  case PIXEL_INDEX8:
+    return inverse[index_of(rgb)];
+  default:
+    return rgb;
+  }
+}
+
+void framebuffer_t::pack(void *dst, const uint32_t *src, uint32_t n) const {
+  switch (format) {
+  case PIXEL_RGBA8:
+    memcpy(dst, src, n * 4);
+    break;
+  case PIXEL_RGB565:
+    pack_rgb565((uint16_t *)dst, src, n);
+    break;
+  case PIXEL_INDEX8:
+    pack_index8((uint8_t *)dst, src, n, inverse.data());
+    break;
+  }
+}
+
+void framebuffer_t::unpack(uint32_t *dst, const void *src, uint32_t n) const {
+  switch (format) {
+  case PIXEL_RGBA8:
+    memcpy(dst, src, n * 4);
+    break;
+  case PIXEL_RGB565:
+    unpack_rgb565(dst, (const uint16_t *)src, n);
+    break;
+  case PIXEL_INDEX8: {
+    const uint8_t *s = (const uint8_t *)src;
+    for (uint32_t i = 0; i < n; ++i) {
+      dst[i] = palette[s[i]];
+    }
+  } break;
+  }
+}
+
+void framebuffer_t::enable_depth(bool enable) {
+  if (enable) {
+    depth.assign(width * height, 0.f);
+  } else {
+    depth.clear();
+  }
+}
+
+void framebuffer_t::clear(uint32_t rgb) {
+  const std::vector<rect_t> all = {
+    rect_t{0, 0, int32_t(width), int32_t(height)}};
+  clear(rgb, all);
+  dirty.mark_all();
+}
+
+void framebuffer_t::clear(uint32_t rgb, const std::vector<rect_t> &rects) {
+  const uint32_t c = pack(rgb);
+  for (const rect_t &r : rects) {
+    for (int32_t y = r.y0; y < r.y1; ++y) {
+      segments(y, r.x0, r.x1, [&](uint8_t *p, int32_t x0, int32_t x1) {
+        switch (format) {
+        case PIXEL_RGBA8:
+          std::fill((uint32_t *)p + x0, (uint32_t *)p + x1, c);
+          break;
+        case PIXEL_RGB565:
+          std::fill((uint16_t *)p + x0, (uint16_t *)p + x1, uint16_t(c));
+          break;
+        case PIXEL_INDEX8:
+          memset(p + x0, int(c), x1 - x0);
+          break;
+        }
+      });
+      if (!depth.empty()) {
+        float *z = depth_row(y);
+        std::fill(z + r.x0, z + r.x1, 0.f);
+      }
+    }
+  }
+}
+
+void framebuffer_t::clear_checker(uint32_t rgb) {
+  const uint32_t c = pack(rgb);
+  for (uint32_t y = 0; y < height; ++y) {
+    // pixels with x + y + checker even
+    const int32_t odd = int32_t((y + checker) & 1);
+    segments(int32_t(y), 0, int32_t(width),
+             [&](uint8_t *p, int32_t x0, int32_t x1) {
+      const int32_t x = x0 + ((x0 ^ odd) & 1);
+      switch (format) {
+      case PIXEL_RGBA8:
+        for (int32_t i = x; i < x1; i += 2) {
+          ((uint32_t *)p)[i] = c;
+        }
+        break;
+      case PIXEL_RGB565:
+        for (int32_t i = x; i < x1; i += 2) {
+          ((uint16_t *)p)[i] = uint16_t(c);
+        }
+        break;
+      case PIXEL_INDEX8:
+        for (int32_t i = x; i < x1; i += 2) {
+          p[i] = uint8_t(c);
+        }
+        break;
+      }
+    });
+  }
+  std::fill(depth.begin(), depth.end(), 0.f);
+  dirty.mark_all();
+}
+
+void framebuffer_t::plot(int32_t x, int32_t y, uint32_t rgb) {
+  if (x < 0 || y < 0 || x >= int32_t(width) || y >= int32_t(height)) {
+    return;
+  }
+  uint8_t *p = at(x, y);
+  const uint32_t c = pack(rgb);
+  dirty.mark(x, y, x + 1, y + 1);
+  switch (format) {
+  case PIXEL_RGBA8:
+    *(uint32_t *)p = c;
+    break;
+  case PIXEL_RGB565:
+    *(uint16_t *)p = uint16_t(c);
+    break;
+  case PIXEL_INDEX8:
+    *p = uint8_t(c);
+    break;
+  }
+}
+
+namespace {
+
+// copy a rectangle out of the tiled layout a tile at a time, so reads stay
+// within one tile's pages
+template <typename copy_t>
+void detile(const framebuffer_t &fb, void *dst, uint32_t dst_pitch,
+            pixel_format_t dst_format, const rect_t &r, const copy_t &copy) {
+  const int32_t tile_size = int32_t(framebuffer_t::tile_size);
+  const uint32_t src_size = pixel_size(fb.format);
+  const uint32_t dst_size = pixel_size(dst_format);
+  const uint32_t row_bytes = tile_size * src_size;
+  for (int32_t ty = r.y0 & ~(tile_size - 1); ty < r.y1;
+       ty += tile_size) {
+    const int32_t y0 = std::max(ty, r.y0);
+    const int32_t y1 = std::min(ty + tile_size, r.y1);
+    for (int32_t tx = r.x0 & ~(tile_size - 1); tx < r.x1;
+         tx += tile_size) {
+      const int32_t x0 = std::max(tx, r.x0);
+      const int32_t x1 = std::min(tx + tile_size, r.x1);
+      const uint8_t *in = fb.at(x0, y0);
+      uint8_t *out = (uint8_t *)dst + y0 * dst_pitch + x0 * dst_size;
+      if (dst_format == fb.format && x1 - x0 == tile_size) {
+        // whole tile rows are aligned, so copy them with simd
+        for (int32_t y = y0; y < y1; ++y) {
+          const __m128i *s = (const __m128i *)in;
+          __m128i *d = (__m128i *)out;
+          for (uint32_t i = 0; i < row_bytes / 16; ++i) {
+            _mm_storeu_si128(d + i, _mm_load_si128(s + i));
+          }
+          in += row_bytes;
+          out += dst_pitch;
+        }
+        continue;
+      }
+      for (int32_t y = y0; y < y1; ++y) {
+        copy(in, out, uint32_t(x1 - x0));
+        in += row_bytes;
+        out += dst_pitch;
+      }
+    }
+  }
+}
+
+} // namespace {}
+
+void framebuffer_t::present(void *dst, uint32_t dst_pitch,
+                            pixel_format_t dst_format) const {
+  const std::vector<rect_t> all = {
+    rect_t{0, 0, int32_t(width), int32_t(height)}};
+  present(dst, dst_pitch, dst_format, all);
+}
+
+void framebuffer_t::present(void *dst, uint32_t dst_pitch,
+                            pixel_format_t dst_format,
+                            const std::vector<rect_t> &rects) const {
+  // other formats are packed to 8bit through this target's palette
+  assert(dst_format != PIXEL_INDEX8 || format == PIXEL_INDEX8 ||
+         !inverse.empty());
+  if (dst_format == PIXEL_INDEX8 && format != PIXEL_INDEX8 &&
+      inverse.empty()) {
+    return;
+  }
+  const uint32_t src_size = pixel_size(format);
+  const uint32_t dst_size = pixel_size(dst_format);
+  std::vector<uint32_t> tmp(tile_size);
+  const auto copy = [&](const uint8_t *in, uint8_t *out, uint32_t n) {
+    if (dst_format == format) {
+      memcpy(out, in, n * src_size);
+      return;
+    }
+    if (dst_format == PIXEL_RGBA8) {
+      // unpack straight into the destination
+      unpack((uint32_t *)out, in, n);
+      return;
+    }
+    for (uint32_t i = 0; i < n; i += tile_size) {
+      const uint32_t m = std::min(n - i, uint32_t(tile_size));
+      unpack(tmp.data(), in + i * src_size, m);
+      switch (dst_format) {
+      case PIXEL_RGB565:
+        pack_rgb565((uint16_t *)out + i, tmp.data(), m);
+        break;
+      case PIXEL_INDEX8:
+        pack_index8(out + i, tmp.data(), m, inverse.data());
+        break;
+      default:
+        break;
+      }
+    }
+  };
+
+  for (const rect_t &r : rects) {
+    if (layout == LAYOUT_TILED) {
+      detile(*this, dst, dst_pitch, dst_format, r, copy);
+      continue;
+    }
+    const uint32_t n = uint32_t(r.x1 - r.x0);
+    for (int32_t y = r.y0; y < r.y1; ++y) {
+      copy(row(y) + r.x0 * src_size,
+           (uint8_t *)dst + y * dst_pitch + r.x0 * dst_size, n);
+    }
+  }
+}
+
+namespace {
+
+// repeat each of n pixels k times
+void replicate_row(uint32_t *dst, const uint32_t *src, uint32_t n,
+                   uint32_t k) {
+  uint32_t i = 0;
+  if (k == 2) {
+    for (; i + 4 <= n; i += 4) {
+      const __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+      _mm_storeu_si128((__m128i *)(dst + i * 2), _mm_unpacklo_epi32(v, v));
+      _mm_storeu_si128((__m128i *)(dst + i * 2 + 4),
+                       _mm_unpackhi_epi32(v, v));
+    }
+  }
+  for (; i < n; ++i) {
+    std::fill(dst + i * k, dst + i * k + k, src[i]);
+  }
+}
+
+// blend of a and b with an 8 bit weight f on b
+uint32_t lerp(uint32_t a, uint32_t b, uint32_t f) {
+  const uint32_t g = 256 - f;
+  const uint32_t rb = ((a & 0xff00ff) * g + (b & 0xff00ff) * f) >> 8;
+  const uint32_t ag =
+      ((a >> 8) & 0xff00ff) * g + ((b >> 8) & 0xff00ff) * f;
+  return (rb & 0xff00ff) | (ag & 0xff00ff00);
+}
+
+// blend two rows of n pixels with an 8 bit weight f on b
+void lerp_rows(uint32_t *dst, const uint32_t *a, const uint32_t *b,
+               uint32_t n, uint32_t f) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i wa = _mm_set1_epi16(int16_t(256 - f));
+  const __m128i wb = _mm_set1_epi16(int16_t(f));
+  uint32_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    const __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+    const __m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+    // a * (256 - f) + b * f fits 16 bits unsigned
+    const __m128i lo = _mm_srli_epi16(
+        _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(va, zero), wa),
+                      _mm_mullo_epi16(_mm_unpacklo_epi8(vb, zero), wb)),
+        8);
+    const __m128i hi = _mm_srli_epi16(
+        _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(va, zero), wa),
+                      _mm_mullo_epi16(_mm_unpackhi_epi8(vb, zero), wb)),
+        8);
+    _mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(lo, hi));
+  }
+  for (; i < n; ++i) {
+    dst[i] = lerp(a[i], b[i], f);
+  }
+}
+
+// 16.16 source position of the centre of output pixel i of n, scaling from
+// size source pixels
+int32_t sample_pos(uint32_t i, uint32_t n, uint32_t size) {
+  const int64_t p = (int64_t(2 * i + 1) * size << 16) / (2 * int64_t(n));
+  return std::max(int32_t(p - 0x8000), 0);
+}
+
+} // namespace {}
+
+void framebuffer_t::present_scaled(void *dst, uint32_t dst_pitch,
+                                   pixel_format_t dst_format,
+                                   uint32_t dst_w, uint32_t dst_h) {
+  assert(dst_format != PIXEL_INDEX8 || !inverse.empty());
+  if (!width || !height ||
+      (dst_format == PIXEL_INDEX8 && inverse.empty())) {
+    return;
+  }
+
+  // everything is scaled from linear 32bit pixels
+  const uint32_t *src = (const uint32_t *)pixels.data();
+  if (format != PIXEL_RGBA8 || layout != LAYOUT_LINEAR) {
+    scale_linear_.resize(width * height);
+    present(scale_linear_.data(), width * 4, PIXEL_RGBA8);
+    src = scale_linear_.data();
+  }
+
+  // a whole output row, written in place when the formats match
+  if (dst_format != PIXEL_RGBA8) {
+    scale_row_.resize(dst_w);
+  }
+  const auto out_row = [&](uint32_t y) {
+    return (dst_format == PIXEL_RGBA8)
+               ? (uint32_t *)((uint8_t *)dst + y * dst_pitch)
+               : scale_row_.data();
+  };
+  const auto emit = [&](uint32_t y, const uint32_t *row) {
+    uint8_t *out = (uint8_t *)dst + y * dst_pitch;
+    switch (dst_format) {
+    case PIXEL_RGBA8:
+      if ((const void *)row != out) {
+        memcpy(out, row, dst_w * 4);
+      }
+      break;
+    case PIXEL_RGB565:
+      pack_rgb565((uint16_t *)out, row, dst_w);
+      break;
+    case PIXEL_INDEX8:
+      pack_index8(out, row, dst_w, inverse.data());
+      break;
+    }
+  };
+
+  if (dst_w % width == 0 && dst_h % height == 0) {
+    // integer ratio, expand each source row once and repeat it
+    const uint32_t kx = dst_w / width, ky = dst_h / height;
+    for (uint32_t y = 0; y < height; ++y) {
+      uint32_t *row = out_row(y * ky);
+      replicate_row(row, src + y * width, width, kx);
+      for (uint32_t i = 0; i < ky; ++i) {
+        emit(y * ky + i, row);
+      }
+    }
+    return;
+  }
+
+  // column of each output pixel and its weights as 16bit lanes, the left
+  // pixel's four channels then the right's. only made again for new sizes.
+  std::vector<uint32_t> &column = scale_column_;
+  std::vector<int16_t> &weight = scale_weight_;
+  if (dst_w != scale_w_ || width != scale_src_w_) {
+    column.resize(dst_w);
+    weight.resize(dst_w * 8);
+    for (uint32_t x = 0; x < dst_w; ++x) {
+      const int32_t p = sample_pos(x, dst_w, width);
+      const int16_t f = int16_t((p >> 8) & 0xff);
+      column[x] = std::min(uint32_t(p >> 16), width - 1);
+      std::fill(weight.data() + x * 8, weight.data() + x * 8 + 4,
+                int16_t(256 - f));
+      std::fill(weight.data() + x * 8 + 4, weight.data() + x * 8 + 8, f);
+    }
+    scale_w_ = dst_w;
+    scale_src_w_ = width;
+  }
+
+  // the vertically filtered row, with the last pixel repeated so the right
+  // neighbour can always be read
+  std::vector<uint32_t> &blend = scale_blend_;
+  blend.resize(width + 1);
+  const __m128i zero = _mm_setzero_si128();
+  for (uint32_t y = 0; y < dst_h; ++y) {
+    const int32_t p = sample_pos(y, dst_h, height);
+    const uint32_t y0 = std::min(uint32_t(p >> 16), height - 1);
+    const uint32_t y1 = std::min(y0 + 1, height - 1);
+    lerp_rows(blend.data(), src + y0 * width, src + y1 * width, width,
+              uint32_t(p >> 8) & 0xff);
+    blend[width] = blend[width - 1];
+
+    uint32_t *row = out_row(y);
+    for (uint32_t x = 0; x < dst_w; ++x) {
+      const __m128i pair = _mm_unpacklo_epi8(
+          _mm_loadl_epi64((const __m128i *)(blend.data() + column[x])),
+          zero);
+      const __m128i m = _mm_mullo_epi16(
+          pair, _mm_loadu_si128((const __m128i *)(weight.data() + x * 8)));
+      const __m128i sum =
+          _mm_srli_epi16(_mm_add_epi16(m, _mm_srli_si128(m, 8)), 8);
+      row[x] = uint32_t(_mm_cvtsi128_si32(_mm_packus_epi16(sum, sum)));
+    }
+    emit(y, row);
+  }
+}
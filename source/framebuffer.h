@@ -0,0 +1,208 @@
+#pragma once
+#include <cstdint>
+
+#include <algorithm>
+#include <vector>
+
+#include "dirty.h"
+#include "pages.h"
+
+enum pixel_format_t {
+  // 32bit 0xAARRGGBB
+  PIXEL_RGBA8,
+  // 16bit 5:6:5
+  PIXEL_RGB565,
+  // 8bit palette index
+  PIXEL_INDEX8,
+};
+
+inline uint32_t pixel_size(pixel_format_t format) {
+  switch (format) {
+  case PIXEL_RGB565:
+    return 2;
+  case PIXEL_INDEX8:
+    return 1;
+  default:
+    return 4;
+  }
+}
+
+enum fb_layout_t {
+  // rows one after another
+  LAYOUT_LINEAR,
+  // 32x32 pixel tiles each contiguous in memory, row major within a tile.
+  // a tall triangle then touches a few pages rather than one per row.
+  LAYOUT_TILED,
+};
+
+// how often triangles are shaded, coverage and depth stay per pixel. the
+// values are ordered so the coarser of two rates is the larger.
+enum shading_rate_t {
+  RATE_1X1,
+  // half the pixels in a checkerboard, alternating each frame, the others
+  // keep last frame's colour. opaque triangles only.
+  RATE_CHECKER,
+  // one shade copied over each 2x1, 2x2 or 4x4 block of pixels
+  RATE_2X1,
+  RATE_2X2,
+  RATE_4X4,
+};
+
+// a render target in one of the pixel formats above. all rendering is done
+// as 32bit colour and converted on store, so the smaller formats trade a
+// little arithmetic for a half or a quarter of the memory traffic.
+struct framebuffer_t {
+
+  framebuffer_t()
+    : width(0)
+    , height(0)
+    , pitch(0)
+    , format(PIXEL_RGBA8)
+    , layout(LAYOUT_LINEAR)
+    , tiles_x(0)
+    , rate(RATE_1X1)
+    , checker(0)
+    , scale_w_(0)
+    , scale_src_w_(0)
+  {
+  }
+
+  static const uint32_t tile_shift = 5;
+  static const uint32_t tile_size = 1u << tile_shift;
+
+  void init(uint32_t w, uint32_t h, pixel_format_t fmt,
+            fb_layout_t lay = LAYOUT_LINEAR);
+
+  // replace the palette used by PIXEL_INDEX8, rebuilding the inverse lookup
+  void set_palette(const uint32_t *rgb, uint32_t count);
+
+  // attach or detach a depth buffer, triangles are depth tested when one
+  // is attached
+  void enable_depth(bool enable);
+
+  void clear(uint32_t rgb);
+
+  // clear only the given rectangles, including their depth
+  void clear(uint32_t rgb, const std::vector<rect_t> &rects);
+
+  // clear the half of the pixels RATE_CHECKER shades this frame, and all
+  // of the depth
+  void clear_checker(uint32_t rgb);
+
+  // start of a row, linear layout only
+  uint8_t *row(uint32_t y) {
+    return pixels.data() + y * pitch;
+  }
+
+  const uint8_t *row(uint32_t y) const {
+    return pixels.data() + y * pitch;
+  }
+
+  // address of a pixel in either layout
+  uint8_t *at(uint32_t x, uint32_t y) const {
+    if (layout == LAYOUT_LINEAR) {
+      return pixels.data() + y * pitch + x * pixel_size(format);
+    }
+    const uint32_t tile = (x >> tile_shift) + (y >> tile_shift) * tiles_x;
+    const uint32_t in = (x & (tile_size - 1)) +
+                        ((y & (tile_size - 1)) << tile_shift);
+    return pixels.data() +
+           ((tile << (tile_shift * 2)) + in) * pixel_size(format);
+  }
+
+  // call fn(row, s0, s1) for each part [s0, s1) of row y between x0 and x1
+  // that is contiguous in memory, with pixel x at row + x * pixel size. the
+  // linear layout has one part, the tiled layout one per tile.
+  template <typename fn_t>
+  void segments(int32_t y, int32_t x0, int32_t x1, fn_t fn) const {
+    const int32_t size = int32_t(pixel_size(format));
+    if (layout == LAYOUT_LINEAR) {
+      fn(pixels.data() + y * pitch, x0, x1);
+      return;
+    }
+    for (int32_t x = x0; x < x1;) {
+      const int32_t end =
+          std::min(x1, (x | int32_t(tile_size - 1)) + 1);
+      fn(at(x, y) - x * size, x, end);
+      x = end;
+    }
+  }
+
+  // pack 32bit pixels src[x0, x1) into row y
+  void store(int32_t y, int32_t x0, int32_t x1, const uint32_t *src) {
+    segments(y, x0, x1, [&](uint8_t *r, int32_t s0, int32_t s1) {
+      pack(r + s0 * pixel_size(format), src + s0, s1 - s0);
+    });
+  }
+
+  // depth is stored as 1/w so larger is nearer
+  float *depth_row(uint32_t y) {
+    return depth.data() + y * width;
+  }
+
+  // convert n 32bit pixels into this format at dst
+  void pack(void *dst, const uint32_t *src, uint32_t n) const;
+
+  // convert n pixels of this format at src into 32bit pixels
+  void unpack(uint32_t *dst, const void *src, uint32_t n) const;
+
+  // convert a single colour into this format
+  uint32_t pack(uint32_t rgb) const;
+
+  void plot(int32_t x, int32_t y, uint32_t rgb);
+
+  // copy the whole target into a linear image of another format. a
+  // PIXEL_INDEX8 image takes the nearest entries of the target's palette,
+  // so a target of another format needs one from set_palette first.
+  void present(void *dst, uint32_t dst_pitch, pixel_format_t dst_format) const;
+
+  // copy only the given rectangles
+  void present(void *dst, uint32_t dst_pitch, pixel_format_t dst_format,
+               const std::vector<rect_t> &rects) const;
+
+  // copy the whole target into a linear image of another format and size.
+  // whole multiples of the size replicate pixels, anything else is
+  // filtered bilinearly. its working buffers are kept for the next call.
+  void present_scaled(void *dst, uint32_t dst_pitch, pixel_format_t dst_format,
+                      uint32_t dst_w, uint32_t dst_h);
+
+  uint32_t width, height;
+  // bytes per row in the linear layout
+  uint32_t pitch;
+  pixel_format_t format;
+  fb_layout_t layout;
+  // tiles across a row of tiles in the tiled layout
+  uint32_t tiles_x;
+  page_buffer_t pixels;
+  // PIXEL_INDEX8 palette and a 15bit rgb to index lookup
+  std::vector<uint32_t> palette;
+  std::vector<uint8_t> inverse;
+  // empty unless depth testing is enabled
+  std::vector<float> depth;
+  // tiles drawn this frame and last frame
+  dirty_t dirty;
+  // triangles are only drawn inside this rectangle, the whole target
+  // after init
+  rect_t scissor;
+  // the rate triangles are shaded at, and if not empty a rate from
+  // RATE_1X1 to RATE_4X4 for each tile_size square of the screen, tiles_x
+  // across. the coarser of the two applies.
+  shading_rate_t rate;
+  std::vector<uint8_t> rate_map;
+  // which half of the pixels RATE_CHECKER shades, flipped every frame
+  uint32_t checker;
+
+protected:
+  // present_scaled's linear copy of the target, output row and vertically
+  // filtered row
+  std::vector<uint32_t> scale_linear_, scale_row_, scale_blend_;
+  // its source column and weights for each output pixel, made for scaling
+  // scale_src_w_ pixels to scale_w_
+  std::vector<uint32_t> scale_column_;
+  std::vector<int16_t> scale_weight_;
+  uint32_t scale_w_, scale_src_w_;
+};
+
+// simd format conversions over n pixels
+void pack_rgb565(uint16_t *dst, const uint32_t *src, uint32_t n);
+void unpack_rgb565(uint32_t *dst, const uint16_t *src, uint32_t n);
@@ -0,0 +1,155 @@
+#include <algorithm>
+#include <cmath>
+
+#include "hsr.h"
+
+using namespace math;
+
+const uint32_t hsr_t::none;
+
+void hsr_t::init(uint32_t width, uint32_t height) {
+  width_ = width;
+  height_ = height;
+  bucket_.resize(height);
+  clear();
+}
+
+void hsr_t::clear() {
+  row_ = 0;
+  edges_.clear();
+  polys_.clear();
+  active_.clear();
+  std::fill(bucket_.begin(), bucket_.end(), none);
+}
+
+void hsr_t::add_edge(const vec4f_t &a, const vec4f_t &b, uint32_t poly) {
+  // the edge covers the rows with centres in [a.y, b.y)
+  const int32_t y0 = std::max(int32_t(ceilf(a.y)), 0);
+  const int32_t y1 = std::min(int32_t(ceilf(b.y)) - 1, int32_t(height_) - 1);
+  if (y0 > y1) {
+    return;
+  }
+  const float dx = (b.x - a.x) / (b.y - a.y);
+  const edge_t e = {a.x + dx * (float(y0) - a.y), dx, y1, poly, bucket_[y0]};
+  bucket_[y0] = uint32_t(edges_.size());
+  edges_.push_back(e);
+}
+
+void hsr_t::add(const std::array<vec4f_t, 3> &t, uint32_t id) {
+  // sort vertices: top (0), mid (1), bottom (2)
+  std::array<vec4f_t, 3> v = t;
+  if (v[1].y < v[0].y)
+    std::swap(v[1], v[0]);
+  if (v[2].y < v[0].y)
+    std::swap(v[2], v[0]);
+  if (v[2].y < v[1].y)
+    std::swap(v[2], v[1]);
+
+  const float x1 = v[1].x - v[0].x, y1 = v[1].y - v[0].y;
+  const float x2 = v[2].x - v[0].x, y2 = v[2].y - v[0].y;
+  const float area = x1 * y2 - x2 * y1;
+  if (area == 0.f || v[2].y < 0.f || v[0].y >= float(height_)) {
+    return;
+  }
+
+  // 1/w is linear in screen space
+  const float q0 = 1.f / v[0].w, q1 = 1.f / v[1].w, q2 = 1.f / v[2].w;
+  const float ia = 1.f / area;
+  poly_t p;
+  p.dx = ((q1 - q0) * y2 - (q2 - q0) * y1) * ia;
+  p.dy = ((q2 - q0) * x1 - (q1 - q0) * x2) * ia;
+  p.c = q0 - v[0].x * p.dx - v[0].y * p.dy;
+  p.id = id;
+
+  const uint32_t poly = uint32_t(polys_.size());
+  polys_.push_back(p);
+  add_edge(v[0], v[2], poly);
+  add_edge(v[0], v[1], poly);
+  add_edge(v[1], v[2], poly);
+}
+
+uint32_t hsr_t::nearest(float x, float y) const {
+  uint32_t best = inside_[0];
+  float q = depth(best, x, y);
+  for (size_t i = 1; i < inside_.size(); ++i) {
+    const float d = depth(inside_[i], x, y);
+    if (d > q) {
+      q = d;
+      best = inside_[i];
+    }
+  }
+  return best;
+}
+
+void hsr_t::resolve(int32_t x0, int32_t x1, int32_t y,
+                    std::vector<vis_run_t> &out) {
+  const float fy = float(y);
+  const uint32_t a = nearest(float(x0), fy);
+  if (x1 - x0 > 1) {
+    const uint32_t b = nearest(float(x1 - 1), fy);
+    if (a != b) {
+      // the surfaces cross somewhere inside, subdivide
+      const int32_t xm = (x0 + x1) / 2;
+      resolve(x0, xm, y, out);
+      resolve(xm, x1, y, out);
+      return;
+    }
+  }
+  const uint32_t id = polys_[a].id;
+  if (!out.empty() && out.back().x1 == x0 && out.back().id == id) {
+    out.back().x1 = x1;
+  } else {
+    out.push_back(vis_run_t{x0, x1, id});
+  }
+}
+
+void hsr_t::runs(uint32_t y, std::vector<vis_run_t> &out) {
+  out.clear();
+  if (y != row_ || y >= height_) {
+    return;
+  }
+  ++row_;
+
+  // retire finished edges and step the rest down to this row
+  size_t n = 0;
+  for (const edge_t &e : active_) {
+    if (e.y1 >= int32_t(y)) {
+      active_[n] = e;
+      active_[n].x += e.dx;
+      ++n;
+    }
+  }
+  active_.resize(n);
+  // edges starting on this row join the list
+  for (uint32_t i = bucket_[y]; i != none; i = edges_[i].next) {
+    active_.push_back(edges_[i]);
+  }
+  // the list stays almost sorted from row to row, so insertion sort
+  for (size_t i = 1; i < active_.size(); ++i) {
+    const edge_t e = active_[i];
+    size_t j = i;
+    for (; j > 0 && active_[j - 1].x > e.x; --j) {
+      active_[j] = active_[j - 1];
+    }
+    active_[j] = e;
+  }
+
+  // sweep left to right, each crossing toggles a polygon in or out. pixel
+  // x is covered where ceil(left) <= x < ceil(right).
+  inside_.clear();
+  const int32_t w = int32_t(width_);
+  int32_t x = 0;
+  for (const edge_t &e : active_) {
+    const int32_t cx = std::min(std::max(int32_t(ceilf(e.x)), 0), w);
+    if (!inside_.empty() && cx > x) {
+      resolve(x, cx, int32_t(y), out);
+    }
+    x = std::max(x, cx);
+    const auto it = std::find(inside_.begin(), inside_.end(), e.poly);
+    if (it == inside_.end()) {
+      inside_.push_back(e.poly);
+    } else {
+      inside_.erase(it);
+    }
+  }
+}
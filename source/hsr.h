@@ -0,0 +1,86 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "math.h"
+#include "visbuf.h"
+
+// whole scene scanline hidden surface removal, in the style of watkins. all
+// triangle edges are bucketed by their first scanline, then each row is
+// produced in turn from an active edge list, resolving visibility between
+// edge crossings so every output pixel is written once with no overdraw and
+// no frame sized depth or id buffer.
+struct hsr_t {
+
+  hsr_t()
+    : width_(0)
+    , height_(0)
+    , row_(0)
+  {
+  }
+
+  void init(uint32_t width, uint32_t height);
+
+  // empty the edge table ready for a new scene
+  void clear();
+
+  // add a screen space triangle, back faces are expected to be rejected
+  void add(const std::array<math::vec4f_t, 3> &t, uint32_t id);
+
+  // the visible runs along a row, rows must be requested in order from 0
+  void runs(uint32_t y, std::vector<vis_run_t> &out);
+
+  uint32_t width() const {
+    return width_;
+  }
+
+  uint32_t height() const {
+    return height_;
+  }
+
+protected:
+  static const uint32_t none = 0xffffffff;
+
+  struct edge_t {
+    // x at the current row and its step per row
+    float x, dx;
+    // last row this edge covers
+    int32_t y1;
+    uint32_t poly;
+    // next edge in the same bucket
+    uint32_t next;
+  };
+
+  // triangle depth as a 1/w plane, q = c + x * dx + y * dy
+  struct poly_t {
+    float c, dx, dy;
+    uint32_t id;
+  };
+
+  float depth(uint32_t poly, float x, float y) const {
+    const poly_t &p = polys_[poly];
+    return p.c + x * p.dx + y * p.dy;
+  }
+
+  // nearest polygon at a pixel of the inside set
+  uint32_t nearest(float x, float y) const;
+
+  // emit the visible runs over [x0, x1), splitting where the nearest
+  // polygon changes between the ends
+  void resolve(int32_t x0, int32_t x1, int32_t y, std::vector<vis_run_t> &out);
+
+  void add_edge(const math::vec4f_t &a, const math::vec4f_t &b, uint32_t poly);
+
+  uint32_t width_, height_;
+  // next row to be produced
+  uint32_t row_;
+  std::vector<edge_t> edges_;
+  std::vector<poly_t> polys_;
+  // first edge starting on each row
+  std::vector<uint32_t> bucket_;
+  // edges crossing the current row, sorted by x
+  std::vector<edge_t> active_;
+  // polygons covering the current pixel
+  std::vector<uint32_t> inside_;
+};
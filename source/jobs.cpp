@@ -0,0 +1,277 @@
+#include <algorithm>
+#include <new>
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "jobs.h"
+
+namespace {
+
+// the scheduler and queue owned by the current thread, threads that are not
+// workers share queue 0 of every scheduler
+thread_local const jobs_t *this_jobs = nullptr;
+thread_local uint32_t this_index = 0;
+
+void pin_thread(std::thread &t, int32_t cpu) {
+  if (cpu < 0) {
+    return;
+  }
+#if defined(_WIN32)
+  SetThreadAffinityMask((HANDLE)t.native_handle(), DWORD_PTR(1) << cpu);
+#elif defined(__linux__)
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  pthread_setaffinity_np(t.native_handle(), sizeof(set), &set);
+#else
+  (void)t;
+#endif
+}
+
+} // namespace {}
+
+jobs_t::jobs_t()
+  : quit_(false)
+  , pending_(0)
+  , queued_(0)
+{
+  // everything runs on the calling thread until init
+  queues_.push_back(new queue_t);
+}
+
+jobs_t::~jobs_t() {
+  shutdown();
+  for (queue_t *q : queues_) {
+    delete q;
+  }
+}
+
+void jobs_t::init(const jobs_config_t &config) {
+  shutdown();
+
+  uint32_t workers = config.workers;
+  if (workers == 0) {
+    const uint32_t hw = std::thread::hardware_concurrency();
+    workers = hw > 1 ? hw - 1 : 0;
+  }
+
+  // cpus to pin to, in order
+  std::vector<int32_t> cpus;
+  for (int32_t i = 0; i < 64; ++i) {
+    if (config.affinity & (uint64_t(1) << i)) {
+      cpus.push_back(i);
+    }
+  }
+
+  quit_ = false;
+  while (queues_.size() < workers + 1) {
+    queues_.push_back(new queue_t);
+  }
+  for (queue_t *q : queues_) {
+    q->arena.reserve(config.arena_bytes);
+  }
+  for (uint32_t i = 0; i < workers; ++i) {
+    const int32_t cpu = cpus.empty() ? -1 : cpus[i % cpus.size()];
+    threads_.emplace_back(&jobs_t::worker, this, i + 1);
+    pin_thread(threads_.back(), cpu);
+  }
+}
+
+void jobs_t::shutdown() {
+  if (threads_.empty()) {
+    return;
+  }
+  wait_all();
+  {
+    std::lock_guard<std::mutex> guard(sleep_lock_);
+    quit_ = true;
+  }
+  wake_.notify_all();
+  for (std::thread &t : threads_) {
+    t.join();
+  }
+  threads_.clear();
+}
+
+void *jobs_t::take(size_t bytes, size_t align) {
+  const uint32_t index = self();
+  std::unique_lock<std::mutex> guard(alloc_lock_, std::defer_lock);
+  if (index == 0) {
+    guard.lock();
+  }
+  return queues_[index]->arena.alloc(bytes, align);
+}
+
+task_t *jobs_t::alloc(size_t bytes, size_t align) {
+  const uint32_t index = self();
+  queue_t *q = queues_[index];
+  std::unique_lock<std::mutex> guard(alloc_lock_, std::defer_lock);
+  if (index == 0) {
+    guard.lock();
+  }
+  task_t *task = new (q->arena.alloc<task_t>(1)) task_t;
+  task->data = bytes ? q->arena.alloc(bytes, align) : nullptr;
+  q->made.push_back(task);
+  guard.unlock();
+  task->call = nullptr;
+  task->destroy = nullptr;
+  task->next = nullptr;
+  // held until all dependencies are registered
+  task->waiting = 1;
+  task->done = false;
+  ++pending_;
+  return task;
+}
+
+void jobs_t::depend(task_t *task, task_t *dep) {
+  if (!dep) {
+    return;
+  }
+  task_link_t *link = (task_link_t *)take(sizeof(task_link_t),
+                                          alignof(task_link_t));
+  std::lock_guard<std::mutex> guard(dep->lock);
+  if (!dep->done) {
+    ++task->waiting;
+    link->task = task;
+    link->next = dep->next;
+    dep->next = link;
+  }
+}
+
+void jobs_t::release(task_t *task) {
+  if (--task->waiting == 0) {
+    push(task);
+  }
+}
+
+task_t *jobs_t::submit(task_t *task, task_t *const *dep,
+                       task_t *const *end) {
+  for (; dep != end; ++dep) {
+    depend(task, *dep);
+  }
+  release(task);
+  return task;
+}
+
+void jobs_t::push(task_t *task) {
+  queue_t *q = queues_[self()];
+  {
+    std::lock_guard<std::mutex> guard(q->lock);
+    q->tasks.push_back(task);
+  }
+  {
+    std::lock_guard<std::mutex> guard(sleep_lock_);
+    ++queued_;
+  }
+  wake_.notify_one();
+}
+
+task_t *jobs_t::pop(uint32_t self) {
+  if (queued_ == 0) {
+    return nullptr;
+  }
+  const uint32_t n = uint32_t(queues_.size());
+  // newest from our own queue first, it is most likely still in cache
+  {
+    queue_t *q = queues_[self];
+    std::lock_guard<std::mutex> guard(q->lock);
+    if (!q->tasks.empty()) {
+      task_t *task = q->tasks.pop_back();
+      --queued_;
+      return task;
+    }
+  }
+  // otherwise steal the oldest from someone else
+  for (uint32_t i = 1; i < n; ++i) {
+    queue_t *q = queues_[(self + i) % n];
+    std::lock_guard<std::mutex> guard(q->lock);
+    if (!q->tasks.empty()) {
+      task_t *task = q->tasks.pop_front();
+      --queued_;
+      return task;
+    }
+  }
+  return nullptr;
+}
+
+void jobs_t::run(task_t *task) {
+  if (task->call) {
+    task->call(task->data);
+  }
+  task_link_t *next;
+  {
+    std::lock_guard<std::mutex> guard(task->lock);
+    task->done = true;
+    next = task->next;
+    task->next = nullptr;
+  }
+  for (; next; next = next->next) {
+    release(next->task);
+  }
+  // the task must not be touched after this
+  --pending_;
+}
+
+uint32_t jobs_t::self() const {
+  return (this_jobs == this) ? this_index : 0;
+}
+
+void jobs_t::worker(uint32_t index) {
+  this_jobs = this;
+  this_index = index;
+  for (;;) {
+    if (task_t *task = pop(index)) {
+      run(task);
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(sleep_lock_);
+    wake_.wait(lock, [&]() { return quit_ || queued_ > 0; });
+    if (quit_ && queued_ == 0) {
+      return;
+    }
+  }
+}
+
+void jobs_t::wait(task_t *task) {
+  while (!task->done) {
+    if (task_t *t = pop(self())) {
+      run(t);
+    } else {
+      std::this_thread::yield();
+    }
+  }
+}
+
+void jobs_t::wait_all() {
+  while (pending_ > 0) {
+    if (task_t *t = pop(self())) {
+      run(t);
+    } else {
+      std::this_thread::yield();
+    }
+  }
+  std::lock_guard<std::mutex> guard(alloc_lock_);
+  for (queue_t *q : queues_) {
+    for (task_t *task : q->made) {
+      if (task->destroy) {
+        task->destroy(task->data);
+      }
+      task->~task_t();
+    }
+    q->made.clear();
+    q->arena.reset();
+  }
+}
+
+size_t jobs_t::arena_peak() const {
+  size_t peak = 0;
+  for (const queue_t *q : queues_) {
+    peak = std::max(peak, q->arena.peak());
+  }
+  return peak;
+}
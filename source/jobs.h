@@ -0,0 +1,247 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstddef>
+#include <initializer_list>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "arena.h"
+
+struct task_t;
+
+// one entry in a task's list of tasks to release, lives in an arena
+struct task_link_t {
+  task_t *task;
+  task_link_t *next;
+};
+
+// a unit of work. a task becomes runnable once every task it depends on has
+// finished, and finishing it releases any tasks that depend on it.
+struct task_t {
+  // the callable is copied into the arena beside the task, call is null
+  // for a task that only joins others
+  void (*call)(void *);
+  void (*destroy)(void *);
+  void *data;
+  // dependencies yet to finish, plus one while the task is being set up
+  std::atomic<int32_t> waiting;
+  std::atomic<bool> done;
+  // tasks to release when this one finishes
+  std::mutex lock;
+  task_link_t *next;
+};
+
+// a double ended queue of tasks in one ring buffer, which only allocates
+// when it grows past its largest size so far
+struct task_ring_t {
+
+  task_ring_t()
+    : head_(0)
+    , size_(0)
+  {
+  }
+
+  bool empty() const {
+    return size_ == 0;
+  }
+
+  void push_back(task_t *task) {
+    if (size_ == ring_.size()) {
+      grow();
+    }
+    ring_[(head_ + size_++) & (ring_.size() - 1)] = task;
+  }
+
+  task_t *pop_back() {
+    return ring_[(head_ + --size_) & (ring_.size() - 1)];
+  }
+
+  task_t *pop_front() {
+    task_t *task = ring_[head_];
+    head_ = (head_ + 1) & (ring_.size() - 1);
+    --size_;
+    return task;
+  }
+
+protected:
+  void grow() {
+    std::vector<task_t *> ring(ring_.empty() ? 64 : ring_.size() * 2);
+    for (size_t i = 0; i < size_; ++i) {
+      ring[i] = ring_[(head_ + i) & (ring_.size() - 1)];
+    }
+    ring_.swap(ring);
+    head_ = 0;
+  }
+
+  // a power of two in size
+  std::vector<task_t *> ring_;
+  size_t head_, size_;
+};
+
+struct jobs_config_t {
+  // worker threads, not counting the calling thread. 0 picks one less than
+  // the number of hardware threads.
+  uint32_t workers;
+  // cpus the workers may be pinned to, one bit per cpu. workers are pinned
+  // round robin to the set bits. 0 leaves scheduling to the os.
+  uint64_t affinity;
+  // bytes to reserve up front in each thread's arena, see arena_peak
+  size_t arena_bytes;
+};
+
+// one work stealing scheduler shared by every stage of the pipeline so that
+// stages never bring their own threads and oversubscribe the machine. each
+// thread owns a deque, pushing and popping its own work at the back while
+// idle threads steal from the front of the others. tasks, their callables
+// and dependency links all live in the arenas, so once warmed up a frame
+// makes no heap allocations.
+struct jobs_t {
+
+  jobs_t();
+  ~jobs_t();
+
+  void init(const jobs_config_t &config);
+
+  // stop and join all workers, outstanding tasks are run first
+  void shutdown();
+
+  // queue fn() to run after all of deps have finished. fn is copied into
+  // the arena, a null fn gives a task that only joins its dependencies.
+  template <typename fn_t>
+  task_t *add(fn_t &&fn, std::initializer_list<task_t *> deps = {}) {
+    return submit(make(std::forward<fn_t>(fn)), deps.begin(), deps.end());
+  }
+
+  template <typename fn_t>
+  task_t *add(fn_t &&fn, const std::vector<task_t *> &deps) {
+    return submit(make(std::forward<fn_t>(fn)), deps.data(),
+                  deps.data() + deps.size());
+  }
+
+  // split [begin, end) into chunks of at most grain items, calling
+  // fn(begin, end) for each as tasks that may run in parallel. returns a
+  // task that finishes after every chunk has.
+  template <typename fn_t>
+  task_t *parallel_for(uint32_t begin, uint32_t end, uint32_t grain,
+                       fn_t &&fn, std::initializer_list<task_t *> deps = {}) {
+    typedef typename std::decay<fn_t>::type body_t;
+    grain = (grain > 0) ? grain : 1;
+    // one copy of fn, owned by the joining task and shared by the chunks
+    task_t *all = alloc(sizeof(body_t), alignof(body_t));
+    const body_t *body = new (all->data) body_t(std::forward<fn_t>(fn));
+    if (!std::is_trivially_destructible<body_t>::value) {
+      all->destroy = &destroy_fn<body_t>;
+    }
+    for (uint32_t i = begin; i < end; i += grain) {
+      const uint32_t j = (end - i > grain) ? i + grain : end;
+      task_t *chunk = add(chunk_t<body_t>{body, i, j}, deps);
+      depend(all, chunk);
+    }
+    release(all);
+    return all;
+  }
+
+  // run tasks on the calling thread until a task has finished
+  void wait(task_t *task);
+
+  // run tasks until everything queued has finished, then free all tasks
+  // and reset every arena
+  void wait_all();
+
+  // transient memory for the calling thread, valid until wait_all. tasks
+  // themselves are allocated here too. threads outside the pool share the
+  // arena of the thread that called init, so must not use it concurrently.
+  arena_t &arena() {
+    return queues_[self()]->arena;
+  }
+
+  // the largest arena use of any one thread
+  size_t arena_peak() const;
+
+  // threads that run tasks, including the calling thread
+  uint32_t threads() const {
+    return uint32_t(queues_.size());
+  }
+
+protected:
+  struct queue_t {
+    std::mutex lock;
+    task_ring_t tasks;
+    // tasks made by this thread since the last wait_all, they live in arena
+    arena_t arena;
+    std::vector<task_t *> made;
+  };
+
+  // a chunk of a parallel_for, small enough to copy around freely
+  template <typename body_t>
+  struct chunk_t {
+    const body_t *body;
+    uint32_t i, j;
+    void operator()() const {
+      (*body)(i, j);
+    }
+  };
+
+  template <typename fn_t>
+  static void call_fn(void *data) {
+    (*(fn_t *)data)();
+  }
+
+  template <typename fn_t>
+  static void destroy_fn(void *data) {
+    ((fn_t *)data)->~fn_t();
+  }
+
+  template <typename fn_t>
+  task_t *make(fn_t &&fn) {
+    typedef typename std::decay<fn_t>::type body_t;
+    task_t *task = alloc(sizeof(body_t), alignof(body_t));
+    new (task->data) body_t(std::forward<fn_t>(fn));
+    task->call = &call_fn<body_t>;
+    if (!std::is_trivially_destructible<body_t>::value) {
+      task->destroy = &destroy_fn<body_t>;
+    }
+    return task;
+  }
+
+  task_t *make(std::nullptr_t) {
+    return alloc(0, 1);
+  }
+
+  // register deps and queue the task
+  task_t *submit(task_t *task, task_t *const *dep, task_t *const *end);
+
+  // a task with bytes of storage for its callable
+  task_t *alloc(size_t bytes, size_t align);
+  // arena memory for the calling thread
+  void *take(size_t bytes, size_t align);
+  void depend(task_t *task, task_t *dep);
+  void release(task_t *task);
+  void push(task_t *task);
+  task_t *pop(uint32_t self);
+  void run(task_t *task);
+  void worker(uint32_t index);
+  // queue of the calling thread
+  uint32_t self() const;
+
+  // queue 0 belongs to the thread that called init
+  std::vector<queue_t *> queues_;
+  std::vector<std::thread> threads_;
+  std::atomic<bool> quit_;
+  // tasks created and not yet finished
+  std::atomic<uint32_t> pending_;
+
+  // idle workers sleep here
+  std::mutex sleep_lock_;
+  std::condition_variable wake_;
+  std::atomic<uint32_t> queued_;
+
+  // queue 0 is shared by every thread that is not a worker
+  std::mutex alloc_lock_;
+};
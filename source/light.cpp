@@ -0,0 +1,109 @@
+#include <cstdint>
+
+#include <xmmintrin.h>
+#include <emmintrin.h>
+
+#include "light.h"
+
+using namespace math;
+
+namespace {
+
+// four vectors in structure of arrays form
+struct soa3_t {
+  __m128 x, y, z;
+
+  void load(const vec3f_t *v) {
+    x = _mm_setr_ps(v[0].x, v[1].x, v[2].x, v[3].x);
+    y = _mm_setr_ps(v[0].y, v[1].y, v[2].y, v[3].y);
+    z = _mm_setr_ps(v[0].z, v[1].z, v[2].z, v[3].z);
+  }
+};
+
+__m128 dot(const soa3_t &a, const __m128 &x, const __m128 &y,
+           const __m128 &z) {
+  return _mm_add_ps(_mm_add_ps(_mm_mul_ps(a.x, x), _mm_mul_ps(a.y, y)),
+                    _mm_mul_ps(a.z, z));
+}
+
+} // namespace {}
+
+void light_rig_t::shade(const uint32_t num_verts,
+                        const vec3f_t *pos,
+                        const vec3f_t *normal,
+                        uint32_t *rgb) const {
+
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 one = _mm_set1_ps(1.f);
+  const __m128 scale = _mm_set1_ps(255.f);
+
+  for (uint32_t i = 0; i < num_verts; i += 4) {
+
+    soa3_t p, n;
+    const uint32_t count = (num_verts - i) < 4 ? (num_verts - i) : 4;
+    if (count == 4) {
+      p.load(pos + i);
+      n.load(normal + i);
+    } else {
+      // pad the tail batch by repeating the last vertex
+      vec3f_t tp[4], tn[4];
+      for (uint32_t j = 0; j < 4; ++j) {
+        const uint32_t k = i + (j < count ? j : count - 1);
+        tp[j] = pos[k];
+        tn[j] = normal[k];
+      }
+      p.load(tp);
+      n.load(tn);
+    }
+
+    __m128 r = _mm_set1_ps(ambient.x);
+    __m128 g = _mm_set1_ps(ambient.y);
+    __m128 b = _mm_set1_ps(ambient.z);
+
+    for (const light_t &l : lights) {
+      __m128 k;
+      switch (l.type) {
+      case LIGHT_DIRECTIONAL:
+        k = dot(n, _mm_set1_ps(l.v.x), _mm_set1_ps(l.v.y),
+                _mm_set1_ps(l.v.z));
+        break;
+      case LIGHT_POINT: {
+        const __m128 dx = _mm_sub_ps(_mm_set1_ps(l.v.x), p.x);
+        const __m128 dy = _mm_sub_ps(_mm_set1_ps(l.v.y), p.y);
+        const __m128 dz = _mm_sub_ps(_mm_set1_ps(l.v.z), p.z);
+        const __m128 d2 = _mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)),
+            _mm_mul_ps(dz, dz));
+        // n.d / |d| / (1 + falloff * |d|^2)
+        const __m128 atten = _mm_rcp_ps(
+            _mm_add_ps(one, _mm_mul_ps(d2, _mm_set1_ps(l.falloff))));
+        k = _mm_mul_ps(dot(n, dx, dy, dz), _mm_rsqrt_ps(d2));
+        k = _mm_mul_ps(k, atten);
+      } break;
+      default:
+        continue;
+      }
+      k = _mm_max_ps(k, zero);
+      r = _mm_add_ps(r, _mm_mul_ps(k, _mm_set1_ps(l.colour.x)));
+      g = _mm_add_ps(g, _mm_mul_ps(k, _mm_set1_ps(l.colour.y)));
+      b = _mm_add_ps(b, _mm_mul_ps(k, _mm_set1_ps(l.colour.z)));
+    }
+
+    // saturate and pack to 0xRRGGBB
+    const __m128i ir = _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(r, one), scale));
+    const __m128i ig = _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(g, one), scale));
+    const __m128i ib = _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(b, one), scale));
+    const __m128i out = _mm_or_si128(
+        _mm_or_si128(_mm_slli_epi32(ir, 16), _mm_slli_epi32(ig, 8)), ib);
+
+    if (count == 4) {
+      _mm_storeu_si128((__m128i *)(rgb + i), out);
+    } else {
+      uint32_t tmp[4];
+      _mm_storeu_si128((__m128i *)tmp, out);
+      for (uint32_t j = 0; j < count; ++j) {
+        rgb[i + j] = tmp[j];
+      }
+    }
+  }
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "math.h"
+
+enum light_type_t { LIGHT_DIRECTIONAL, LIGHT_POINT };
+
+struct light_t {
+  light_type_t type;
+  // direction towards the light, or its position, in view space
+  math::vec3f_t v;
+  // rgb intensity
+  math::vec3f_t colour;
+  // point light attenuation, 1 / (1 + falloff * d^2)
+  float falloff;
+};
+
+// a set of lights evaluated per vertex
+struct light_rig_t {
+
+  light_rig_t()
+    : ambient{0.1f, 0.1f, 0.1f}
+  {
+  }
+
+  // shade view space vertices, writing packed 0xRRGGBB colours. vertices
+  // are processed four at a time in structure of arrays form.
+  void shade(const uint32_t num_verts,
+             const math::vec3f_t *pos,
+             const math::vec3f_t *normal,
+             uint32_t *rgb) const;
+
+  math::vec3f_t ambient;
+  std::vector<light_t> lights;
+};
@@ -2,37 +2,282 @@
 #include <SDL.h>
 
 #include <cassert>
+#include <cmath>
 #include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
 #include <array>
+#include <chrono>
+#include <vector>
 
-#include "math.h"
+#include "dynres.h"
+#include "light.h"
+#include "mesh.h"
+#include "scanline.h"
+#include "writer.h"
 
 using namespace math;
 
-void draw_line(SDL_Surface *, math::vec2f_t, math::vec2f_t, uint32_t rgb);
-void draw_tri(SDL_Surface *, const std::array<math::vec4f_t, 3> &, uint32_t rgb);
-
 struct app_t {
 
   vec3f_t rot_;
+  // null when rendering offline
   SDL_Surface *surf_;
+  // size presented, the render target is smaller under dynamic resolution
+  uint32_t out_w_, out_h_;
+  dynres_t dynres_;
+  framebuffer_t fb_;
   matrix_t mat_;
+  matrix_t view_;
+  matrix_t proj_;
+  matrix_t viewport_;
+  matrix_stack_t stack_;
+  mesh_t mesh_;
+  light_rig_t rig_;
+  texture_t tex_;
+  shade_mode_t mode_;
+  tex_filter_t filter_;
+  msaa_target_t msaa_;
+  // 0 for no multisampling, otherwise 4 or 8
+  uint32_t samples_;
+  blend_t blend_;
+  // triangle draw order for translucent geometry
+  std::vector<uint32_t> order_;
+  // screen areas to present, and the same as SDL rectangles
+  std::vector<rect_t> rects_;
+  std::vector<SDL_Rect> update_;
+  hidden_mode_t hidden_;
+  // the mesh as strips joined by restart indices
+  std::vector<uint32_t> strip_;
+  bool use_strip_;
+  // quantized copy of the mesh and its strips
+  packed_mesh_t packed_;
+  std::vector<uint16_t> strip16_;
+  bool use_packed_;
+  // pairs of nearly coplanar triangles merged into quads
+  std::vector<uint32_t> poly_;
+  std::vector<uint16_t> poly16_;
+  bool use_poly_;
+  // triangles reordered for locality on screen
+  bool spatial_;
+  // redraw only what changed, and hold the rotation to see it pay off
+  bool coherent_;
+  bool paused_;
+  // shading rate for the mesh, and coarser shading away from the centre
+  shading_rate_t rate_;
+  bool foveated_;
+  // a grid of views around the mesh in place of the single view
+  bool grid_;
+  // what the per frame vertices were computed from, 0 if never
+  uint64_t vertex_key_;
+  // shared by every parallel stage
+  jobs_t jobs_;
+  render_context_t ctx_;
+
+  // per frame screen space vertices
+  std::vector<vec4f_t> screen_;
+  // per frame view space vertices and their lit colours
+  std::vector<vec3f_t> view_pos_;
+  std::vector<vec3f_t> view_normal_;
+  std::vector<uint32_t> colour_;
+  // per triangle flat colours and per vertex texture coordinates
+  std::vector<uint32_t> tri_rgb_;
+  std::vector<vec2f_t> uv_;
+  // screen space vertices for each grid view, one after another
+  std::vector<vec4f_t> grid_screen_;
 
-  app_t(SDL_Surface *surf)
+  app_t(SDL_Surface *surf, uint32_t width, uint32_t height,
+        const jobs_config_t &jobs)
     : rot_{0.f, 0.f, 0.f}
     , surf_(surf)
+    , out_w_(width)
+    , out_h_(height)
+    , mode_(SHADE_GOURAUD)
+    , filter_(TEX_FILTER_BILINEAR)
+    , samples_(0)
+    , blend_{BLEND_NONE, 255}
+    , hidden_(HIDDEN_NONE)
+    , use_strip_(false)
+    , use_packed_(false)
+    , use_poly_(false)
+    , spatial_(false)
+    , coherent_(false)
+    , paused_(false)
+    , rate_(RATE_1X1)
+    , foveated_(false)
+    , grid_(false)
+    , vertex_key_(0)
   {
     mat_.identity();
+    // look at the origin from -z, with y down the screen as before
+    view_.look_at(vec3f_t{0.f, 0.f, -250.f}, vec3f_t{0.f, 0.f, 0.f},
+                  vec3f_t{0.f, -1.f, 0.f});
+    const float n = 10.f, e = n * 57.f / 250.f;
+    proj_.frustum(-e, e, -e, e, n, 1000.f);
+    viewport_.viewport(0.f, 0.f, float(width), float(height));
+    fb_.init(width, height, PIXEL_RGBA8);
+    jobs_.init(jobs);
+    ctx_.set_jobs(&jobs_);
+    load_mesh();
+    make_lights();
+    make_texture();
+  }
+
+  void load_mesh() {
+    extern const float obj_vertex[];
+    extern const uint32_t obj_index[];
+    extern const uint32_t obj_num_vertex;
+    extern const uint32_t obj_num_index;
+    mesh_.load(obj_vertex, obj_num_vertex, obj_index, obj_num_index);
+    if (spatial_) {
+      mesh_.sort_spatial();
+    }
+    mesh_.stripify(strip_);
+    packed_.pack(mesh_);
+    if (!packed_.pack_index(strip_, strip16_)) {
+      strip16_.clear();
+    }
+    mesh_.polygonize(poly_);
+    if (!packed_.pack_index(poly_, poly16_)) {
+      poly16_.clear();
+    }
+
+    // strips number their triangles differently, so colour enough for both
+    tri_rgb_.resize(std::max(mesh_.index.size() / 3, strip_.size()));
+    for (uint32_t j = 0; j < tri_rgb_.size(); ++j) {
+      tri_rgb_[j] = 0xff000000 | wang_hash(j * 3);
+    }
+    // planar mapping in object space
+    uv_.resize(mesh_.num_vertex());
+    for (uint32_t i = 0; i < mesh_.num_vertex(); ++i) {
+      uv_[i] = vec2f_t{mesh_.pos[i].x, mesh_.pos[i].z} * (1.f / 32.f);
+    }
+  }
+
+  void make_lights() {
+    rig_.ambient = vec3f_t{0.08f, 0.08f, 0.1f};
+    rig_.lights.push_back(light_t{LIGHT_DIRECTIONAL,
+                                  vec3f_t::normalize(vec3(-.4f, .6f, 1.f)),
+                                  vec3f_t{.9f, .85f, .7f}, 0.f});
+    rig_.lights.push_back(light_t{LIGHT_POINT, vec3f_t{60.f, -40.f, -210.f},
+                                  vec3f_t{.2f, .4f, .9f}, .0002f});
+  }
+
+  // generate a checker board test texture
+  void make_texture() {
+    const uint32_t size = 256;
+    std::vector<uint32_t> img(size * size);
+    for (uint32_t y = 0; y < size; ++y) {
+      for (uint32_t x = 0; x < size; ++x) {
+        const bool check = ((x >> 5) ^ (y >> 5)) & 1;
+        img[x + y * size] =
+            check ? 0xffe0e0e0 : (0xff000040 | (x << 16) | (y << 8));
+      }
+    }
+    tex_.load(img.data(), size, size);
+  }
+
+  void on_key(SDLKey key) {
+    switch (key) {
+    case SDLK_1:
+      mode_ = SHADE_FLAT;
+      break;
+    case SDLK_2:
+      mode_ = SHADE_GOURAUD;
+      break;
+    case SDLK_3:
+      mode_ = SHADE_TEXTURE;
+      break;
+    case SDLK_f:
+      filter_ = (filter_ == TEX_FILTER_NEAREST) ? TEX_FILTER_BILINEAR
+                                                : TEX_FILTER_NEAREST;
+      break;
+    case SDLK_m:
+      // cycle off, 4x, 8x
+      samples_ = (samples_ == 0) ? 4 : ((samples_ == 4) ? 8 : 0);
+      if (samples_) {
+        msaa_.init(fb_.width, fb_.height, samples_);
+      }
+      break;
+    case SDLK_p:
+      // cycle 32bit, 16bit and 8bit render targets
+      fb_.init(fb_.width, fb_.height,
+               (fb_.format == PIXEL_RGBA8)
+                   ? PIXEL_RGB565
+                   : ((fb_.format == PIXEL_RGB565) ? PIXEL_INDEX8
+                                                   : PIXEL_RGBA8),
+               fb_.layout);
+      break;
+    case SDLK_t:
+      fb_.init(fb_.width, fb_.height, fb_.format,
+               (fb_.layout == LAYOUT_LINEAR) ? LAYOUT_TILED : LAYOUT_LINEAR);
+      break;
+    case SDLK_b:
+      // cycle opaque, translucent, additive
+      blend_.mode = (blend_.mode == BLEND_NONE)
+                        ? BLEND_PREMUL
+                        : ((blend_.mode == BLEND_PREMUL) ? BLEND_ADD
+                                                         : BLEND_NONE);
+      blend_.opacity = (blend_.mode == BLEND_ADD) ? 96 : 160;
+      break;
+    case SDLK_z:
+      fb_.enable_depth(fb_.depth.empty());
+      break;
+    case SDLK_v:
+      // cycle painter's order, visibility buffer, scanline
+      hidden_ = (hidden_ == HIDDEN_NONE)
+                    ? HIDDEN_VISBUF
+                    : ((hidden_ == HIDDEN_VISBUF) ? HIDDEN_SCANLINE
+                                                  : HIDDEN_NONE);
+      break;
+    case SDLK_s:
+      use_strip_ = !use_strip_;
+      break;
+    case SDLK_q:
+      use_packed_ = !use_packed_;
+      break;
+    case SDLK_o:
+      use_poly_ = !use_poly_;
+      break;
+    case SDLK_h:
+      spatial_ = !spatial_;
+      load_mesh();
+      break;
+    case SDLK_c:
+      coherent_ = !coherent_;
+      ctx_.set_coherent(coherent_);
+      break;
+    case SDLK_SPACE:
+      paused_ = !paused_;
+      break;
+    case SDLK_g:
+      grid_ = !grid_;
+      break;
+    case SDLK_r:
+      // cycle full, 2x1, 2x2, 4x4, checkerboard and foveated shading
+      if (foveated_) {
+        foveated_ = false;
+      } else if (rate_ == RATE_CHECKER) {
+        rate_ = RATE_1X1;
+        foveated_ = true;
+      } else {
+        rate_ = (rate_ == RATE_1X1)
+                    ? RATE_2X1
+                    : ((rate_ == RATE_2X1)
+                           ? RATE_2X2
+                           : ((rate_ == RATE_2X2) ? RATE_4X4 : RATE_CHECKER));
+      }
+      break;
+    default:
+      break;
+    }
   }
 
   // plot a pixel to the screen
   void plot(float x, float y, uint32_t rgb = 0xdadada) {
-    assert(surf_);
-    if (x < 0.f || y < 0.f || x >= surf_->w || y >= surf_->h) {
-      return;
-    }
-    uint32_t *pix = (uint32_t *)surf_->pixels;
-    pix[int(x) + int(y) * surf_->w] = rgb;
+    fb_.plot(int32_t(x), int32_t(y), rgb);
   }
 
   uint32_t wang_hash(uint32_t seed)
@@ -45,49 +290,369 @@ struct app_t {
       return seed;
   }
 
-  void render() {
-    extern const float obj_vertex[];
-    extern const uint32_t obj_index[];
-    extern const uint32_t obj_num_vertex;
-    extern const uint32_t obj_num_index;
+  // fnv-1a over raw bytes
+  static uint64_t hash(const void *data, size_t size, uint64_t h) {
+    const uint8_t *p = (const uint8_t *)data;
+    for (size_t i = 0; i < size; ++i) {
+      h = (h ^ p[i]) * 0x100000001b3ull;
+    }
+    return h;
+  }
 
-    std::array<vec4f_t, 3> pre;
-    std::array<vec4f_t, 3> post;
-    for (uint32_t i = 0; i < obj_num_index; i += 3) {
+  // full rate shading near the centre of the screen, coarser further out
+  void make_fovea() {
+    const uint32_t size = framebuffer_t::tile_size;
+    const uint32_t tiles_y = (fb_.height + size - 1) / size;
+    fb_.rate_map.resize(fb_.tiles_x * tiles_y);
+    const float cx = fb_.width * .5f, cy = fb_.height * .5f;
+    const float radius = std::min(cx, cy);
+    for (uint32_t ty = 0; ty < tiles_y; ++ty) {
+      for (uint32_t tx = 0; tx < fb_.tiles_x; ++tx) {
+        const float dx = (tx + .5f) * size - cx, dy = (ty + .5f) * size - cy;
+        const float r = sqrtf(dx * dx + dy * dy) / radius;
+        fb_.rate_map[tx + ty * fb_.tiles_x] = uint8_t(
+            (r < .5f) ? RATE_1X1 : ((r < .8f) ? RATE_2X2 : RATE_4X4));
+      }
+    }
+  }
 
-      const std::array<uint32_t, 3> index = {
-        obj_index[i + 0],
-        obj_index[i + 1],
-        obj_index[i + 2],
-      };
+  // light every vertex once per frame
+  task_t *light() {
+    const uint32_t num = mesh_.num_vertex();
+    view_normal_.resize(num);
+    view_pos_.resize(num);
+    colour_.resize(num);
 
-      const vec3f_t *bunny = (const vec3f_t*)obj_vertex;
-      pre[0] = vec4(bunny[index[0]], 1.f);
-      pre[1] = vec4(bunny[index[1]], 1.f);
-      pre[2] = vec4(bunny[index[2]], 1.f);
+    const matrix_t model_view = mat_ * view_;
+    const matrix_t packed_view = packed_.dequantize() * model_view;
 
-      mat_.transform(3, pre.data(), post.data());
+    return jobs_.parallel_for(0, num, 1024, [=](uint32_t i0, uint32_t i1) {
+      const uint32_t n = i1 - i0;
+      vec3f_t *normal = view_normal_.data() + i0;
+      if (use_packed_) {
+        packed_.unpack_normals(i0, i1, normal);
+      }
+      // the vec3 transform only applies the rotation part of the matrix
+      model_view.transform(n, use_packed_ ? normal : mesh_.normal.data() + i0,
+                           normal);
 
-      for (auto &v : post) {
-        v.x = 256 + v.x * 4.5f;
-        v.y = 256 + v.y * 4.5f;
+      for (uint32_t i = i0; i < i1; ++i) {
+        vec4f_t v;
+        if (use_packed_) {
+          const vec3u16_t &q = packed_.pos[i];
+          v = vec4f_t{float(q.x), float(q.y), float(q.z), 1.f};
+          packed_view.transform(1, &v, &v);
+        } else {
+          v = vec4(mesh_.pos[i], 1.f);
+          model_view.transform(1, &v, &v);
+        }
+        view_pos_[i] = vec3(v);
       }
 
-      draw_tri(surf_, post, wang_hash(i));
+      rig_.shade(n, view_pos_.data() + i0, view_normal_.data() + i0,
+                 colour_.data() + i0);
+    });
+  }
+
+  // the mesh turned to several angles side by side, every vertex projected
+  // for all of the views in one pass
+  void draw_grid(const draw_batch_t &batch, const draw_state_t &state) {
+    static const uint32_t side = 3, count = side * side;
+    const uint32_t n = mesh_.num_vertex();
+    const uint32_t cw = fb_.width / side, ch = fb_.height / side;
+    grid_screen_.resize(n * count);
+
+    std::array<matrix_t, count> mvp;
+    std::array<view_t, count> views;
+    for (uint32_t k = 0; k < count; ++k) {
+      const uint32_t x = (k % side) * cw, y = (k / side) * ch;
+      matrix_t spin, port;
+      spin.rotate(0.f, 6.2831853f * float(k) / float(count), 0.f);
+      port.viewport(float(x), float(y), float(cw), float(ch));
+      mvp[k] = mat_ * spin * view_ * proj_ * port;
+      if (use_packed_) {
+        mvp[k] = packed_.dequantize() * mvp[k];
+      }
+      views[k] = view_t{grid_screen_.data() + k * n, nullptr,
+                        rect_t{int32_t(x), int32_t(y), int32_t(x + cw),
+                               int32_t(y + ch)}};
+    }
+
+    jobs_.wait(jobs_.parallel_for(0, n, 1024, [&](uint32_t i0, uint32_t i1) {
+      std::array<vec4f_t *, count> out;
+      for (uint32_t k = 0; k < count; ++k) {
+        out[k] = grid_screen_.data() + k * n + i0;
+      }
+      if (use_packed_) {
+        matrix_t::project(mvp.data(), count, i1 - i0,
+                          packed_.pos.data() + i0, out.data());
+      } else {
+        matrix_t::project(mvp.data(), count, i1 - i0, mesh_.pos.data() + i0,
+                          out.data());
+      }
+    }));
+    ctx_.draw_views(batch, state, views.data(), count);
+  }
+
+  void render() {
+    // model, view, projection and viewport as a single matrix
+    stack_.push();
+    stack_.load(viewport_);
+    stack_.mult(proj_);
+    stack_.mult(view_);
+    stack_.mult(mat_);
+    if (use_packed_) {
+      stack_.mult(packed_.dequantize());
+    }
+    const matrix_t mvp = stack_.top();
+    stack_.pop();
+
+    // the transformed and lit vertices only change with these
+    const uint32_t flags = mode_ | (use_packed_ << 8);
+    uint64_t key = 0xcbf29ce484222325ull;
+    key = hash(&mvp, sizeof(mvp), key);
+    key = hash(&mat_, sizeof(mat_), key);
+    key = hash(&flags, sizeof(flags), key);
+    key = hash(&mesh_.version, sizeof(mesh_.version), key);
+
+    if (key != vertex_key_) {
+      task_t *lit = (mode_ == SHADE_GOURAUD) ? light() : nullptr;
+
+      // one transform per vertex
+      screen_.resize(mesh_.num_vertex());
+      task_t *projected = jobs_.parallel_for(
+          0, mesh_.num_vertex(), 1024, [this, mvp](uint32_t i0, uint32_t i1) {
+            if (use_packed_) {
+              mvp.project(i1 - i0, packed_.pos.data() + i0,
+                          screen_.data() + i0);
+            } else {
+              mvp.project(i1 - i0, mesh_.pos.data() + i0,
+                          screen_.data() + i0);
+            }
+          });
+
+      // rasterization needs both lit and projected vertices
+      jobs_.wait(jobs_.add(nullptr, {lit, projected}));
+      vertex_key_ = key;
+    }
+
+    // translucent geometry is drawn back to front, which needs a list
+    order_.clear();
+    const bool poly = use_poly_ && blend_.mode == BLEND_NONE;
+    const bool strip = use_strip_ && !poly && blend_.mode == BLEND_NONE;
+    if (blend_.mode != BLEND_NONE) {
+      mesh_.sort_back_to_front(screen_.data(), order_);
+    }
+
+    const std::vector<uint32_t> &index =
+        poly ? poly_ : (strip ? strip_ : mesh_.index);
+    const std::vector<uint16_t> &index16 =
+        poly ? poly16_ : (strip ? strip16_ : packed_.index);
+    const bool small = use_packed_ && !index16.empty();
+    // the draw order follows from the vertices and blend state
+    const uintptr_t indices =
+        small ? uintptr_t(index16.data()) : uintptr_t(index.data());
+    const draw_batch_t batch = {
+      screen_.data(),
+      index.data(),
+      uint32_t(index.size()),
+      small ? index16.data() : nullptr,
+      colour_.data(),
+      uv_.data(),
+      tri_rgb_.data(),
+      order_.empty() ? nullptr : order_.data(),
+      poly ? TOPOLOGY_POLYGON : (strip ? TOPOLOGY_STRIP : TOPOLOGY_LIST),
+      strip || poly,
+      hash(&indices, sizeof(indices), key),
+    };
+    const draw_state_t state = {mode_, blend_, &tex_, filter_, rate_};
+    if (foveated_) {
+      make_fovea();
+    } else {
+      fb_.rate_map.clear();
+    }
+
+    // blending is not supported into the multisample target, and views
+    // are drawn straight into the framebuffer
+    const bool msaa = samples_ && blend_.mode == BLEND_NONE && !grid_;
+    ctx_.set_hidden(grid_ ? HIDDEN_NONE : hidden_);
+    ctx_.begin(&fb_, 0x101010, msaa ? &msaa_ : nullptr);
+    if (grid_) {
+      draw_grid(batch, state);
+    } else {
+      ctx_.draw(batch, state);
+    }
+    ctx_.end();
+  }
+
+  // hold the render time under budget_ms by changing the render size
+  void set_budget(float budget_ms) {
+    dynres_.init(out_w_, out_h_, budget_ms);
+  }
+
+  // render at a new size, keeping the target's format, layout and depth
+  void resize(uint32_t width, uint32_t height) {
+    viewport_.viewport(0.f, 0.f, float(width), float(height));
+    fb_.init(width, height, fb_.format, fb_.layout);
+    if (samples_) {
+      msaa_.init(width, height, samples_);
     }
   }
 
   void tick() {
+    typedef std::chrono::steady_clock clock_t;
+    const clock_t::time_point start = clock_t::now();
+
     // update cube rotation
     mat_.rotate(rot_.x, rot_.y, rot_.z);
-    rot_ += math::vec3f_t{0.7032f, 0.2345f, 1.2444f} * 0.003f;
+    if (!paused_) {
+      rot_ += math::vec3f_t{0.7032f, 0.2345f, 1.2444f} * 0.003f;
+    }
     render();
+    jobs_.wait_all();
+
+    const float ms =
+        std::chrono::duration<float, std::milli>(clock_t::now() - start)
+            .count();
+    if (dynres_.update(ms)) {
+      resize(dynres_.width(), dynres_.height());
+    }
+  }
+
+  bool scaled() const {
+    return fb_.width != out_w_ || fb_.height != out_h_;
+  }
+
+  // copy the parts of the render target that changed to the screen
+  void present() {
+    assert(surf_);
+    const pixel_format_t format =
+        (surf_->format->BytesPerPixel == 2) ? PIXEL_RGB565 : PIXEL_RGBA8;
+    if (scaled()) {
+      // the whole frame is filtered, so the dirty tiles are of no use
+      fb_.dirty.next_frame();
+      fb_.present_scaled(surf_->pixels, surf_->pitch, format, out_w_,
+                         out_h_);
+      SDL_UpdateRect(surf_, 0, 0, 0, 0);
+      return;
+    }
+    fb_.dirty.changed_rects(rects_);
+    fb_.dirty.next_frame();
+    if (rects_.empty()) {
+      return;
+    }
+    switch (surf_->format->BytesPerPixel) {
+    case 4:
+      fb_.present(surf_->pixels, surf_->pitch, PIXEL_RGBA8, rects_);
+      break;
+    case 2:
+      fb_.present(surf_->pixels, surf_->pitch, PIXEL_RGB565, rects_);
+      break;
+    }
+    update_.resize(rects_.size());
+    for (size_t i = 0; i < rects_.size(); ++i) {
+      const rect_t &r = rects_[i];
+      update_[i] = SDL_Rect{Sint16(r.x0), Sint16(r.y0), Uint16(r.x1 - r.x0),
+                            Uint16(r.y1 - r.y0)};
+    }
+    SDL_UpdateRects(surf_, int(update_.size()), update_.data());
+  }
+
+  // copy the whole frame out as linear 32bit pixels
+  void capture(uint32_t *dst) {
+    if (scaled()) {
+      fb_.present_scaled(dst, out_w_ * 4, PIXEL_RGBA8, out_w_, out_h_);
+    } else {
+      fb_.present(dst, fb_.width * 4, PIXEL_RGBA8);
+    }
+    fb_.dirty.next_frame();
   }
 };
 
+struct offline_t {
+  const char *path;
+  frame_format_t format;
+  uint32_t frames;
+};
+
+// render frames as fast as possible, handing them to a writer thread
+int render_offline(app_t &app, const offline_t &opt) {
+  frame_writer_t writer;
+  if (!writer.open(opt.path, opt.format, app.out_w_, app.out_h_)) {
+    fprintf(stderr, "unable to open %s\n", opt.path);
+    return 3;
+  }
+
+  typedef std::chrono::steady_clock clock_t;
+  const clock_t::time_point start = clock_t::now();
+  clock_t::time_point report = start;
+  for (uint32_t i = 0; i < opt.frames; ++i) {
+    app.tick();
+    app.capture(writer.acquire());
+    writer.submit();
+
+    const clock_t::time_point now = clock_t::now();
+    if (now - report >= std::chrono::seconds(1)) {
+      const double secs = std::chrono::duration<double>(now - start).count();
+      fprintf(stderr, "frame %u, %.1f fps\n", i + 1, (i + 1) / secs);
+      report = now;
+    }
+  }
+  // the writer must finish for the rate to be sustained
+  writer.close();
+
+  const double secs =
+      std::chrono::duration<double>(clock_t::now() - start).count();
+  printf("%u frames in %.3fs, %.1f fps, writer stalled %u times\n",
+         opt.frames, secs, opt.frames / std::max(secs, 1e-9),
+         writer.stalls());
+  return writer.failed() ? 4 : 0;
+}
+
 // program entry
 int main(const int argc, const char **args) {
 
+  // -j workers, -a cpu affinity mask and -m arena bytes per thread
+  jobs_config_t jobs = {0, 0, 0};
+  // -o path renders -n frames offline in -f ppm, raw or stream format,
+  // after pressing the keys given by -k
+  offline_t offline = {nullptr, FRAME_PPM, 360};
+  const char *keys = "";
+  // -b ms scales the render resolution to keep frames under budget
+  float budget = 0.f;
+  for (int i = 1; i + 1 < argc; ++i) {
+    if (!strcmp(args[i], "-j")) {
+      jobs.workers = uint32_t(strtoul(args[++i], nullptr, 0));
+    } else if (!strcmp(args[i], "-a")) {
+      jobs.affinity = strtoull(args[++i], nullptr, 0);
+    } else if (!strcmp(args[i], "-m")) {
+      jobs.arena_bytes = size_t(strtoull(args[++i], nullptr, 0));
+    } else if (!strcmp(args[i], "-o")) {
+      offline.path = args[++i];
+    } else if (!strcmp(args[i], "-n")) {
+      offline.frames = uint32_t(strtoul(args[++i], nullptr, 0));
+    } else if (!strcmp(args[i], "-f")) {
+      ++i;
+      offline.format = !strcmp(args[i], "raw")
+                           ? FRAME_RAW
+                           : (!strcmp(args[i], "stream") ? FRAME_PPM_STREAM
+                                                         : FRAME_PPM);
+    } else if (!strcmp(args[i], "-k")) {
+      keys = args[++i];
+    } else if (!strcmp(args[i], "-b")) {
+      budget = strtof(args[++i], nullptr);
+    }
+  }
+
+  if (offline.path) {
+    app_t app{nullptr, 512, 512, jobs};
+    app.set_budget(budget);
+    for (const char *k = keys; *k; ++k) {
+      app.on_key(SDLKey(*k));
+    }
+    return render_offline(app, offline);
+  }
+
   if (SDL_Init(SDL_INIT_VIDEO)) {
     return 1;
   }
@@ -97,25 +662,27 @@ int main(const int argc, const char **args) {
     return 2;
   }
 
-  app_t app{surf};
+  app_t app{surf, uint32_t(surf->w), uint32_t(surf->h), jobs};
+  app.set_budget(budget);
 
   bool active = true;
   while (active) {
 
-    SDL_FillRect(surf, nullptr, 0x101010);
-
     SDL_Event event;
     while (SDL_PollEvent(&event)) {
       switch (event.type) {
       case SDL_QUIT:
         active = false;
         break;
+      case SDL_KEYDOWN:
+        app.on_key(event.key.keysym.sym);
+        break;
       }
     }
 
     app.tick();
+    app.present();
 
-    SDL_Flip(surf);
     SDL_Delay(1);
   }
 
@@ -11,13 +11,6 @@
 
 namespace math {
 
-vec3f_t vec3f_t::normalize(const vec3f_t &v) {
-  const float len = sqrtf(v.x*v.x + v.y*v.y + v.z*v.z);
-  return vec3f_t{v.x / len,
-                 v.y / len,
-                 v.z / len};
-}
-
 void matrix_t::identity() {
   memset(e, 0, sizeof(e));
   e[0x0] = e[0x5] = e[0xa] = e[0xf] = 1.f;
@@ -53,6 +46,81 @@ void matrix_t::frustum(
   MAT(3, 3) = 0;
 }
 
+void matrix_t::multiply(const matrix_t &a, const matrix_t &b) {
+  // each output row is a row of a transformed by b
+  float r[16];
+#if MATH_SSE
+  const __m128 b0 = _mm_loadu_ps(b.e + 0x0);
+  const __m128 b1 = _mm_loadu_ps(b.e + 0x4);
+  const __m128 b2 = _mm_loadu_ps(b.e + 0x8);
+  const __m128 b3 = _mm_loadu_ps(b.e + 0xc);
+  for (int i = 0; i < 16; i += 4) {
+    const __m128 x = _mm_set1_ps(a.e[i + 0]);
+    const __m128 y = _mm_set1_ps(a.e[i + 1]);
+    const __m128 z = _mm_set1_ps(a.e[i + 2]);
+    const __m128 w = _mm_set1_ps(a.e[i + 3]);
+    _mm_storeu_ps(r + i,
+                  _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, b0), _mm_mul_ps(y, b1)),
+                             _mm_add_ps(_mm_mul_ps(z, b2), _mm_mul_ps(w, b3))));
+  }
+#else
+  for (int i = 0; i < 4; ++i) {
+    for (int j = 0; j < 4; ++j) {
+      r[i * 4 + j] = a.e[i * 4 + 0] * b.e[0x0 + j] +
+                     a.e[i * 4 + 1] * b.e[0x4 + j] +
+                     a.e[i * 4 + 2] * b.e[0x8 + j] +
+                     a.e[i * 4 + 3] * b.e[0xc + j];
+    }
+  }
+#endif
+  // a or b may be this
+  memcpy(e, r, sizeof(e));
+}
+
+// map [-1, 1] onto [x, x + w] and [y + h, y]
+void matrix_t::viewport(
+    const float x,
+    const float y,
+    const float w,
+    const float h)
+{
+  identity();
+  MAT(0, 0) = w * .5f;
+  MAT(1, 1) =-h * .5f;
+  MAT(3, 0) = x + w * .5f;
+  MAT(3, 1) = y + h * .5f;
+}
+
+void matrix_t::look_at(
+    const vec3f_t &eye,
+    const vec3f_t &at,
+    const vec3f_t &up)
+{
+  const vec3f_t f = vec3f_t::normalize(at - eye);
+  const vec3f_t s = vec3f_t::normalize(vec3f_t::cross(f, up));
+  const vec3f_t u = vec3f_t::cross(s, f);
+
+  MAT(0, 0) = s.x;
+  MAT(1, 0) = s.y;
+  MAT(2, 0) = s.z;
+  MAT(3, 0) =-(s * eye);
+
+  MAT(0, 1) = u.x;
+  MAT(1, 1) = u.y;
+  MAT(2, 1) = u.z;
+  MAT(3, 1) =-(u * eye);
+
+  MAT(0, 2) =-f.x;
+  MAT(1, 2) =-f.y;
+  MAT(2, 2) =-f.z;
+  MAT(3, 2) = (f * eye);
+
+  MAT(0, 3) = 0.f;
+  MAT(1, 3) = 0.f;
+  MAT(2, 3) = 0.f;
+  MAT(3, 3) = 1.f;
+}
+
 /* generate a rotation matrix */
 void matrix_t::rotate(
     const float a,
@@ -91,12 +159,32 @@ void matrix_t::translate(const vec3f_t &p) {
   MAT(3, 3) = 1.f;
 }
 
+void matrix_t::scale(const vec3f_t &s) {
+  MAT(0, 0) = s.x;
+  MAT(1, 1) = s.y;
+  MAT(2, 2) = s.z;
+}
+
 /* transform an array of vectors by a matrix */
 void matrix_t::transform(const uint32_t num_verts,
                          const vec4f_t *in,
-                         vec4f_t *out) {
+                         vec4f_t *out) const {
+#if MATH_SSE
+  const __m128 r0 = _mm_loadu_ps(e + 0x0);
+  const __m128 r1 = _mm_loadu_ps(e + 0x4);
+  const __m128 r2 = _mm_loadu_ps(e + 0x8);
+  const __m128 r3 = _mm_loadu_ps(e + 0xc);
+  for (uint32_t q = 0; q < num_verts; ++q) {
+    const __m128 s = in[q].m;
+    const __m128 x = _mm_shuffle_ps(s, s, _MM_SHUFFLE(0, 0, 0, 0));
+    const __m128 y = _mm_shuffle_ps(s, s, _MM_SHUFFLE(1, 1, 1, 1));
+    const __m128 z = _mm_shuffle_ps(s, s, _MM_SHUFFLE(2, 2, 2, 2));
+    const __m128 w = _mm_shuffle_ps(s, s, _MM_SHUFFLE(3, 3, 3, 3));
+    out[q].m = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, r0), _mm_mul_ps(y, r1)),
+                          _mm_add_ps(_mm_mul_ps(z, r2), _mm_mul_ps(w, r3)));
+  } // for
+#else
   for (uint32_t q = 0; q < num_verts; ++q) {
-    // todo: unroll and use SIMD instructions
     const vec4f_t &s = in[q];
     out[q] = vec4f_t{
       s.x * MAT(0, 0) + s.y * MAT(1, 0) + s.z * MAT(2, 0) + s.w * MAT(3, 0),
@@ -105,12 +193,13 @@ void matrix_t::transform(const uint32_t num_verts,
       s.x * MAT(0, 3) + s.y * MAT(1, 3) + s.z * MAT(2, 3) + s.w * MAT(3, 3),
     };
   } // for
+#endif
 }
 
 /* transform an array of vectors by a matrix */
 void matrix_t::transform(const uint32_t num_verts,
                          const vec3f_t *in,
-                         vec3f_t *out) {
+                         vec3f_t *out) const {
   for (uint32_t q = 0; q < num_verts; ++q) {
     // todo: unroll and use SIMD instructions
     const vec3f_t &s = in[q];
@@ -122,6 +211,122 @@ void matrix_t::transform(const uint32_t num_verts,
   } // for
 }
 
+namespace {
+
+/* transform, perspective divide and viewport map in a single pass */
+template <typename vec_t>
+void project_verts(const float *e,
+                   const uint32_t num_verts,
+                   const vec_t *in,
+                   vec4f_t *out) {
+#if MATH_SSE
+  const __m128 r0 = _mm_loadu_ps(e + 0x0);
+  const __m128 r1 = _mm_loadu_ps(e + 0x4);
+  const __m128 r2 = _mm_loadu_ps(e + 0x8);
+  const __m128 r3 = _mm_loadu_ps(e + 0xc);
+  // lanes to keep from the divided result
+  const __m128 xyz = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
+  for (uint32_t q = 0; q < num_verts; ++q) {
+    const vec_t &s = in[q];
+    const __m128 c = _mm_add_ps(
+        _mm_add_ps(_mm_mul_ps(_mm_set1_ps(float(s.x)), r0),
+                   _mm_mul_ps(_mm_set1_ps(float(s.y)), r1)),
+        _mm_add_ps(_mm_mul_ps(_mm_set1_ps(float(s.z)), r2), r3));
+    const __m128 w = _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 3, 3));
+    const __m128 d = _mm_div_ps(c, w);
+    out[q].m = _mm_or_ps(_mm_and_ps(xyz, d), _mm_andnot_ps(xyz, c));
+  } // for
+#else
+  for (uint32_t q = 0; q < num_verts; ++q) {
+    const float x = float(in[q].x), y = float(in[q].y), z = float(in[q].z);
+    const float w = x * MAT(0, 3) + y * MAT(1, 3) + z * MAT(2, 3) + MAT(3, 3);
+    const float iw = 1.f / w;
+    out[q] = vec4f_t{
+      (x * MAT(0, 0) + y * MAT(1, 0) + z * MAT(2, 0) + MAT(3, 0)) * iw,
+      (x * MAT(0, 1) + y * MAT(1, 1) + z * MAT(2, 1) + MAT(3, 1)) * iw,
+      (x * MAT(0, 2) + y * MAT(1, 2) + z * MAT(2, 2) + MAT(3, 2)) * iw,
+      w,
+    };
+  } // for
+#endif
+}
+
+// views kept in registers at once by project_views
+const uint32_t max_views = 8;
+
+/* project points through several matrices, reading each point once */
+template <typename vec_t>
+void project_views(const matrix_t *views,
+                   const uint32_t num_views,
+                   const uint32_t num_verts,
+                   const vec_t *in,
+                   vec4f_t *const *out) {
+  static_assert(sizeof(matrix_t) == sizeof(float) * 16, "matrix layout");
+  for (uint32_t v0 = 0; v0 < num_views; v0 += max_views) {
+    const uint32_t n = std::min(num_views - v0, max_views);
+    const float *m = (const float *)(views + v0);
+    vec4f_t *const *dst = out + v0;
+#if MATH_SSE
+    __m128 rows[max_views * 4];
+    for (uint32_t i = 0; i < n * 4; ++i) {
+      rows[i] = _mm_loadu_ps(m + i * 4);
+    }
+    const __m128 xyz = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
+    for (uint32_t q = 0; q < num_verts; ++q) {
+      const vec_t &s = in[q];
+      const __m128 x = _mm_set1_ps(float(s.x));
+      const __m128 y = _mm_set1_ps(float(s.y));
+      const __m128 z = _mm_set1_ps(float(s.z));
+      for (uint32_t k = 0; k < n; ++k) {
+        const __m128 *r = rows + k * 4;
+        const __m128 c = _mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(x, r[0]), _mm_mul_ps(y, r[1])),
+            _mm_add_ps(_mm_mul_ps(z, r[2]), r[3]));
+        const __m128 w = _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 3, 3));
+        const __m128 d = _mm_div_ps(c, w);
+        dst[k][q].m = _mm_or_ps(_mm_and_ps(xyz, d), _mm_andnot_ps(xyz, c));
+      }
+    } // for
+#else
+    for (uint32_t q = 0; q < num_verts; ++q) {
+      for (uint32_t k = 0; k < n; ++k) {
+        project_verts(m + k * 16, 1, in + q, dst[k] + q);
+      }
+    } // for
+#endif
+  }
+}
+
+} // namespace {}
+
+void matrix_t::project(const uint32_t num_verts,
+                       const vec3f_t *in,
+                       vec4f_t *out) const {
+  project_verts(e, num_verts, in, out);
+}
+
+void matrix_t::project(const matrix_t *views,
+                       const uint32_t num_views,
+                       const uint32_t num_verts,
+                       const vec3f_t *in,
+                       vec4f_t *const *out) {
+  project_views(views, num_views, num_verts, in, out);
+}
+
+void matrix_t::project(const matrix_t *views,
+                       const uint32_t num_views,
+                       const uint32_t num_verts,
+                       const vec3u16_t *in,
+                       vec4f_t *const *out) {
+  project_views(views, num_views, num_verts, in, out);
+}
+
+void matrix_t::project(const uint32_t num_verts,
+                       const vec3u16_t *in,
+                       vec4f_t *out) const {
+  project_verts(e, num_verts, in, out);
+}
+
 bool matrix_t::invert(matrix_t &out)
 {
     float inv[16];
@@ -196,194 +401,53 @@ void matrix_t::transpose() {
 
 
 // ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
-
-vec3f_t vec3(const vec2f_t &v, float z) {
-  return vec3f_t{v.x, v.y, z};
-}
-
-vec3f_t vec3(const vec4f_t &v) {
-  const float iw = 1.f / v.w;
-  return vec3f_t {v.x * iw, v.y * iw, v.z * iw};
-}
-
-vec4f_t vec4(const vec2f_t &v, float z, float w) {
-  return vec4f_t{v.x, v.y, z, w};
-}
-
-vec4f_t vec4(const vec3f_t &v, float w) {
-  return vec4f_t{v.x, v.y, v.z, w};
-}
-
-// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
-// vector component construction
-
-vec2f_t vec2(const float x,
-             const float y) {
-  return vec2f_t {x, y};
-}
-
-vec3f_t vec3(const float x,
-             const float y,
-             const float z) {
-  return vec3f_t {x, y, z};
-}
-
-vec4f_t vec4(const float x,
-             const float y,
-             const float z,
-             const float w) {
-  return vec4f_t {x, y, z, w};
-}
-
-// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
-// vector addition
-
-vec2f_t operator+(const vec2f_t &a,
-                  const vec2f_t &b) {
-  return vec2f_t{
-    a.x + b.x,
-    a.y + b.y
-  };
-}
-
-vec3f_t operator+(const vec3f_t &a,
-                  const vec3f_t &b) {
-  return vec3f_t{
-    a.x + b.x,
-    a.y + b.y,
-    a.z + b.z
-  };
-}
-
-vec4f_t operator+(const vec4f_t &a,
-                  const vec4f_t &b) {
-  return vec4f_t{
-    a.x + b.x,
-    a.y + b.y,
-    a.z + b.z,
-    a.w + b.w
-  };
-}
-
-// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
-// vector subtraction
-
-vec2f_t operator-(const vec2f_t &a,
-                  const vec2f_t &b) {
-  return vec2f_t{
-    a.x - b.x,
-    a.y - b.y
-  };
-}
-
-vec3f_t operator-(const vec3f_t &a,
-                  const vec3f_t &b) {
-  return vec3f_t{
-    a.x - b.x,
-    a.y - b.y,
-    a.z - b.z
-  };
-}
-
-vec4f_t operator-(const vec4f_t &a,
-                  const vec4f_t &b) {
-  return vec4f_t{
-    a.x - b.x,
-    a.y - b.y,
-    a.z - b.z,
-    a.w - b.w
-  };
-}
-
-// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
-// vector in place addition
-
-void operator+=(vec2f_t &a,
-                const vec2f_t &b) {
-  a.x += b.x;
-  a.y += b.y;
-}
-
-void operator+=(vec3f_t &a,
-                const vec3f_t &b) {
-  a.x += b.x;
-  a.y += b.y;
-  a.z += b.z;
-}
-
-void operator+=(vec4f_t &a,
-                const vec4f_t &b) {
-  a.x += b.x;
-  a.y += b.y;
-  a.z += b.z;
-  a.w += b.w;
-}
-
-// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
-// vector subtraction in place
-
-void operator-=(vec2f_t &a,
-                const vec2f_t &b) {
-  a.x -= b.x;
-  a.y -= b.y;
-}
-
-void operator-=(vec3f_t &a,
-                const vec3f_t &b) {
-  a.x -= b.x;
-  a.y -= b.y;
-  a.z -= b.z;
-}
-
-void operator-=(vec4f_t &a,
-                const vec4f_t &b) {
-  a.x -= b.x;
-  a.y -= b.y;
-  a.z -= b.z;
-  a.w -= b.w;
-}
-
-// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
-// vector scale
-
-vec2f_t operator*(const vec2f_t &a,
-                  const float s) {
-  return vec2f_t{a.x * s, a.y * s};
-}
-
-vec3f_t operator*(const vec3f_t &a,
-                  const float s) {
-  return vec3f_t{a.x * s, a.y * s, a.z * s};
-}
-
-vec4f_t operator*(const vec4f_t &a,
-                  const float s) {
-  return vec4f_t{a.x * s, a.y * s, a.z * s, a.w * s};
-}
-
-// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
-// vector dot product
-
-float operator*(const vec2f_t &a,
-                const vec2f_t &b) {
-  return a.x * b.x + a.y * b.y;
-}
-
-float operator*(const vec3f_t &a,
-                const vec3f_t &b) {
-  return a.x * b.x + a.y * b.y + a.z * b.z;
-}
-
-float operator*(const vec4f_t &a,
-                const vec4f_t &b) {
-  return a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w;
-}
-
-// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
-
-vec3f_t operator/(const vec3f_t &a,
-                  const float s) {
-  return vec3f_t{a.x / s, a.y / s, a.z / s};
+// batch operations
+
+void add(const uint32_t num, const vec4f_t *a, const vec4f_t *b,
+         vec4f_t *out) {
+  for (uint32_t i = 0; i < num; ++i) {
+    out[i] = a[i] + b[i];
+  }
+}
+
+void scale(const uint32_t num, const vec4f_t *a, const float s,
+           vec4f_t *out) {
+  for (uint32_t i = 0; i < num; ++i) {
+    out[i] = a[i] * s;
+  }
+}
+
+void lerp(const uint32_t num, const vec4f_t *a, const vec4f_t *b,
+          const float i, vec4f_t *out) {
+  for (uint32_t j = 0; j < num; ++j) {
+    out[j] = vec4f_t::lerp(a[j], b[j], i);
+  }
+}
+
+void dot(const uint32_t num, const vec4f_t *a, const vec4f_t &b, float *out) {
+  uint32_t i = 0;
+#if MATH_SSE
+  // transpose four vectors at a time so the sum is vertical
+  for (; i + 4 <= num; i += 4) {
+    __m128 r0 = a[i + 0].m, r1 = a[i + 1].m, r2 = a[i + 2].m, r3 = a[i + 3].m;
+    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+    const __m128 d = _mm_add_ps(
+        _mm_add_ps(_mm_mul_ps(r0, _mm_set1_ps(b.x)),
+                   _mm_mul_ps(r1, _mm_set1_ps(b.y))),
+        _mm_add_ps(_mm_mul_ps(r2, _mm_set1_ps(b.z)),
+                   _mm_mul_ps(r3, _mm_set1_ps(b.w))));
+    _mm_storeu_ps(out + i, d);
+  }
+#endif
+  for (; i < num; ++i) {
+    out[i] = a[i] * b;
+  }
+}
+
+void normalize(const uint32_t num, const vec3f_t *in, vec3f_t *out) {
+  for (uint32_t i = 0; i < num; ++i) {
+    out[i] = vec3f_t::normalize(in[i]);
+  }
 }
 
 } // namespace math
@@ -1,4 +1,15 @@
 #pragma once
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+
+// back vec4f_t with an SSE register unless MATH_NO_SIMD is defined
+#if !defined(MATH_NO_SIMD) && \
+    (defined(__SSE2__) || defined(_M_X64) || \
+     (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define MATH_SSE 1
+#include <emmintrin.h>
+#endif
 
 namespace math {
 
@@ -6,6 +17,7 @@ namespace math {
 
 struct vec2f_t;
 struct vec3f_t;
+struct vec3u16_t;
 struct vec4f_t;
 struct matrix_t;
 
@@ -17,9 +29,9 @@ static const float n3d_pi2 = n3d_pi * 2.f;
 // ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
 
 struct util_t {
-  static float lerp(const float &a,
-             const float &b,
-             const float k) {
+  static constexpr float lerp(const float &a,
+                              const float &b,
+                              const float k) {
     return ((1.f - k) * a) + (k * b);
   }
 };
@@ -30,8 +42,7 @@ struct vec2f_t {
 
   union { float e[2]; struct { float x, y; }; };
 
-  static vec2f_t lerp(const vec2f_t &a, const vec2f_t &b, float i) {
-    //(todo) SIMD lerp
+  static constexpr vec2f_t lerp(const vec2f_t &a, const vec2f_t &b, float i) {
     return vec2f_t{
       util_t::lerp(a.x, b.x, i),
       util_t::lerp(a.y, b.y, i)
@@ -43,9 +54,14 @@ struct vec3f_t {
 
   union { float e[3]; struct { float x, y, z; }; };
 
-  static vec3f_t normalize(const vec3f_t &v);
+  static vec3f_t normalize(const vec3f_t &v) {
+    const float il = 1.f / sqrtf(v.x*v.x + v.y*v.y + v.z*v.z);
+    return vec3f_t{v.x * il,
+                   v.y * il,
+                   v.z * il};
+  }
 
-  static vec3f_t cross(const vec3f_t &a, const vec3f_t &b) {
+  static constexpr vec3f_t cross(const vec3f_t &a, const vec3f_t &b) {
     return vec3f_t{
       a.y * b.z - a.z * b.y,
       a.z * b.x - a.x * b.z,
@@ -53,8 +69,7 @@ struct vec3f_t {
     };
   }
 
-  static vec3f_t lerp(const vec3f_t &a, const vec3f_t &b, float i) {
-    //(todo) SIMD lerp
+  static constexpr vec3f_t lerp(const vec3f_t &a, const vec3f_t &b, float i) {
     return vec3f_t{
       util_t::lerp(a.x, b.x, i),
       util_t::lerp(a.y, b.y, i),
@@ -63,25 +78,34 @@ struct vec3f_t {
   }
 };
 
+// a quantized position, see matrix_t::project
+struct vec3u16_t {
+  uint16_t x, y, z;
+};
+
 struct vec4f_t {
 
+#if MATH_SSE
+  union { float e[4]; struct { float x, y, z, w; }; __m128 m; };
+#else
   union { float e[4]; struct { float x, y, z, w; }; };
+#endif
 
-  static vec4f_t lerp(const vec4f_t &a, const vec4f_t &b, float i) {
-    //(todo) SIMD lerp
-    return vec4f_t{
-      util_t::lerp(a.x, b.x, i),
-      util_t::lerp(a.y, b.y, i),
-      util_t::lerp(a.z, b.z, i),
-      util_t::lerp(a.w, b.w, i)
-    };
-  }
+  static vec4f_t lerp(const vec4f_t &a, const vec4f_t &b, float i);
+
+  static vec4f_t normalize(const vec4f_t &v);
 };
 
 struct matrix_t {
 
+  // this = a * b, row vectors so a is applied first
+  void multiply(const matrix_t &a, const matrix_t &b);
+
   void translate(const vec3f_t &p);
 
+  // set the diagonal scale terms
+  void scale(const vec3f_t &s);
+
   bool invert(matrix_t &out);
 
   void rotate(const float x,
@@ -95,13 +119,51 @@ struct matrix_t {
                const float near,
                const float far);
 
+  // map normalized device coordinates onto a screen rectangle, y down
+  void viewport(const float x,
+                const float y,
+                const float w,
+                const float h);
+
+  // right handed view matrix looking down -z
+  void look_at(const vec3f_t &eye,
+               const vec3f_t &at,
+               const vec3f_t &up);
+
   void transform(const uint32_t num_verts,
                  const vec3f_t *in,
-                 vec3f_t *out);
+                 vec3f_t *out) const;
 
   void transform(const uint32_t num_verts,
                  const vec4f_t *in,
-                 vec4f_t *out);
+                 vec4f_t *out) const;
+
+  // transform points and perspective divide in the same pass, the viewport
+  // being folded into the matrix. writes {x/w, y/w, z/w, w}.
+  void project(const uint32_t num_verts,
+               const vec3f_t *in,
+               vec4f_t *out) const;
+
+  // as above from quantized positions, the dequantize scale and bias
+  // being folded into the matrix as well
+  void project(const uint32_t num_verts,
+               const vec3u16_t *in,
+               vec4f_t *out) const;
+
+  // project the same points through each of num_views matrices, out[k]
+  // receiving the points for views[k]. each point is read once for every
+  // view rather than once per view.
+  static void project(const matrix_t *views,
+                      const uint32_t num_views,
+                      const uint32_t num_verts,
+                      const vec3f_t *in,
+                      vec4f_t *const *out);
+
+  static void project(const matrix_t *views,
+                      const uint32_t num_views,
+                      const uint32_t num_verts,
+                      const vec3u16_t *in,
+                      vec4f_t *const *out);
 
   void transpose();
 
@@ -111,107 +173,312 @@ protected:
   float e[16];
 };
 
+inline matrix_t operator*(const matrix_t &a, const matrix_t &b) {
+  matrix_t out;
+  out.multiply(a, b);
+  return out;
+}
 
-// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+// fixed depth matrix stack. like the OpenGL stack, the matrix most recently
+// multiplied on is the first to be applied to a vertex.
+struct matrix_stack_t {
 
-vec3f_t vec3(const vec2f_t &v, float z = 0.f);
+  static const uint32_t max_depth = 16;
 
-vec3f_t vec3(const vec4f_t &v);
+  matrix_stack_t()
+    : depth_(0)
+  {
+    stack_[0].identity();
+  }
 
-vec4f_t vec4(const vec2f_t &v, float z = 0.f, float w = 1.f);
+  void push() {
+    assert(depth_ + 1 < max_depth);
+    stack_[depth_ + 1] = stack_[depth_];
+    ++depth_;
+  }
 
-vec4f_t vec4(const vec3f_t &v, float w = 1.f);
+  void pop() {
+    assert(depth_ > 0);
+    --depth_;
+  }
 
-// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
-// vector component construction
+  void load(const matrix_t &m) {
+    stack_[depth_] = m;
+  }
+
+  void identity() {
+    stack_[depth_].identity();
+  }
+
+  // top = m * top
+  void mult(const matrix_t &m) {
+    stack_[depth_] = m * stack_[depth_];
+  }
 
-vec2f_t vec2(const float x,
-             const float y);
+  const matrix_t &top() const {
+    return stack_[depth_];
+  }
 
-vec3f_t vec3(const float x,
-             const float y,
-             const float z);
+protected:
+  matrix_t stack_[max_depth];
+  uint32_t depth_;
+};
 
-vec4f_t vec4(const float x,
-             const float y,
-             const float z,
-             const float w);
 
 // ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
-// vector addition
 
-vec2f_t operator+(const vec2f_t &a,
-                  const vec2f_t &b);
+constexpr vec3f_t vec3(const vec2f_t &v, float z = 0.f) {
+  return vec3f_t{v.x, v.y, z};
+}
+
+inline vec3f_t vec3(const vec4f_t &v) {
+  const float iw = 1.f / v.w;
+  return vec3f_t {v.x * iw, v.y * iw, v.z * iw};
+}
 
-vec3f_t operator+(const vec3f_t &a,
-                  const vec3f_t &b);
+constexpr vec4f_t vec4(const vec2f_t &v, float z = 0.f, float w = 1.f) {
+  return vec4f_t{v.x, v.y, z, w};
+}
 
-vec4f_t operator+(const vec4f_t &a,
-                  const vec4f_t &b);
+constexpr vec4f_t vec4(const vec3f_t &v, float w = 1.f) {
+  return vec4f_t{v.x, v.y, v.z, w};
+}
 
 // ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
-// vector subtraction
+// vector component construction
+
+constexpr vec2f_t vec2(const float x,
+                       const float y) {
+  return vec2f_t {x, y};
+}
+
+constexpr vec3f_t vec3(const float x,
+                       const float y,
+                       const float z) {
+  return vec3f_t {x, y, z};
+}
+
+constexpr vec4f_t vec4(const float x,
+                       const float y,
+                       const float z,
+                       const float w) {
+  return vec4f_t {x, y, z, w};
+}
+
+#if MATH_SSE
+inline vec4f_t vec4(const __m128 &m) {
+  vec4f_t out;
+  out.m = m;
+  return out;
+}
+#endif
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+// vector addition
 
-vec2f_t operator-(const vec2f_t &a,
-                  const vec2f_t &b);
+constexpr vec2f_t operator+(const vec2f_t &a,
+                            const vec2f_t &b) {
+  return vec2f_t{
+    a.x + b.x,
+    a.y + b.y
+  };
+}
+
+constexpr vec3f_t operator+(const vec3f_t &a,
+                            const vec3f_t &b) {
+  return vec3f_t{
+    a.x + b.x,
+    a.y + b.y,
+    a.z + b.z
+  };
+}
+
+inline vec4f_t operator+(const vec4f_t &a,
+                         const vec4f_t &b) {
+#if MATH_SSE
+  return vec4(_mm_add_ps(a.m, b.m));
+#else
+  return vec4f_t{
+    a.x + b.x,
+    a.y + b.y,
+    a.z + b.z,
+    a.w + b.w
+  };
+#endif
+}
 
-vec3f_t operator-(const vec3f_t &a,
-                  const vec3f_t &b);
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+// vector subtraction
 
-vec4f_t operator-(const vec4f_t &a,
-                  const vec4f_t &b);
+constexpr vec2f_t operator-(const vec2f_t &a,
+                            const vec2f_t &b) {
+  return vec2f_t{
+    a.x - b.x,
+    a.y - b.y
+  };
+}
+
+constexpr vec3f_t operator-(const vec3f_t &a,
+                            const vec3f_t &b) {
+  return vec3f_t{
+    a.x - b.x,
+    a.y - b.y,
+    a.z - b.z
+  };
+}
+
+inline vec4f_t operator-(const vec4f_t &a,
+                         const vec4f_t &b) {
+#if MATH_SSE
+  return vec4(_mm_sub_ps(a.m, b.m));
+#else
+  return vec4f_t{
+    a.x - b.x,
+    a.y - b.y,
+    a.z - b.z,
+    a.w - b.w
+  };
+#endif
+}
 
 // ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
 // vector in place addition
 
-void operator+=(vec2f_t &a,
-                const vec2f_t &b);
+inline void operator+=(vec2f_t &a,
+                       const vec2f_t &b) {
+  a.x += b.x;
+  a.y += b.y;
+}
 
-void operator+=(vec3f_t &a,
-                const vec3f_t &b);
+inline void operator+=(vec3f_t &a,
+                       const vec3f_t &b) {
+  a.x += b.x;
+  a.y += b.y;
+  a.z += b.z;
+}
 
-void operator+=(vec4f_t &a,
-                const vec4f_t &b);
+inline void operator+=(vec4f_t &a,
+                       const vec4f_t &b) {
+  a = a + b;
+}
 
 // ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
 // vector subtraction in place
 
-void operator-=(vec2f_t &a,
-                const vec2f_t &b);
+inline void operator-=(vec2f_t &a,
+                       const vec2f_t &b) {
+  a.x -= b.x;
+  a.y -= b.y;
+}
 
-void operator-=(vec3f_t &a,
-                const vec3f_t &b);
+inline void operator-=(vec3f_t &a,
+                       const vec3f_t &b) {
+  a.x -= b.x;
+  a.y -= b.y;
+  a.z -= b.z;
+}
 
-void operator-=(vec4f_t &a,
-                const vec4f_t &b);
+inline void operator-=(vec4f_t &a,
+                       const vec4f_t &b) {
+  a = a - b;
+}
 
 // ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
 // vector scale
 
-vec2f_t operator*(const vec2f_t &a,
-                  const float s);
+constexpr vec2f_t operator*(const vec2f_t &a,
+                            const float s) {
+  return vec2f_t{a.x * s, a.y * s};
+}
+
+constexpr vec3f_t operator*(const vec3f_t &a,
+                            const float s) {
+  return vec3f_t{a.x * s, a.y * s, a.z * s};
+}
+
+inline vec4f_t operator*(const vec4f_t &a,
+                         const float s) {
+#if MATH_SSE
+  return vec4(_mm_mul_ps(a.m, _mm_set1_ps(s)));
+#else
+  return vec4f_t{a.x * s, a.y * s, a.z * s, a.w * s};
+#endif
+}
 
-vec3f_t operator*(const vec3f_t &a,
-                  const float s);
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+// vector dot product
 
-vec4f_t operator*(const vec4f_t &a,
-                  const float s);
+constexpr float operator*(const vec2f_t &a,
+                          const vec2f_t &b) {
+  return a.x * b.x + a.y * b.y;
+}
+
+constexpr float operator*(const vec3f_t &a,
+                          const vec3f_t &b) {
+  return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+#if MATH_SSE
+// horizontal sum broadcast to every lane
+inline __m128 hsum(__m128 v) {
+  v = _mm_add_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_add_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+}
+#endif
+
+inline float operator*(const vec4f_t &a,
+                       const vec4f_t &b) {
+#if MATH_SSE
+  return _mm_cvtss_f32(hsum(_mm_mul_ps(a.m, b.m)));
+#else
+  return a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w;
+#endif
+}
 
 // ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
-// vector dot product
 
-float operator*(const vec2f_t &a,
-                const vec2f_t &b);
+constexpr vec3f_t operator/(const vec3f_t &a,
+                            const float s) {
+  return vec3f_t{a.x / s, a.y / s, a.z / s};
+}
 
-float operator*(const vec3f_t &a,
-                const vec3f_t &b);
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
 
-float operator*(const vec4f_t &a,
-                const vec4f_t &b);
+inline vec4f_t vec4f_t::lerp(const vec4f_t &a, const vec4f_t &b, float i) {
+#if MATH_SSE
+  // a + (b - a) * i
+  return vec4(_mm_add_ps(a.m, _mm_mul_ps(_mm_sub_ps(b.m, a.m),
+                                         _mm_set1_ps(i))));
+#else
+  return vec4f_t{
+    util_t::lerp(a.x, b.x, i),
+    util_t::lerp(a.y, b.y, i),
+    util_t::lerp(a.z, b.z, i),
+    util_t::lerp(a.w, b.w, i)
+  };
+#endif
+}
+
+inline vec4f_t vec4f_t::normalize(const vec4f_t &v) {
+#if MATH_SSE
+  return vec4(_mm_div_ps(v.m, _mm_sqrt_ps(hsum(_mm_mul_ps(v.m, v.m)))));
+#else
+  return v * (1.f / sqrtf(v * v));
+#endif
+}
 
 // ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+// batch operations over arrays, in and out may alias
+
+void add(const uint32_t num, const vec4f_t *a, const vec4f_t *b, vec4f_t *out);
+
+void scale(const uint32_t num, const vec4f_t *a, const float s, vec4f_t *out);
+
+void lerp(const uint32_t num, const vec4f_t *a, const vec4f_t *b,
+          const float i, vec4f_t *out);
+
+void dot(const uint32_t num, const vec4f_t *a, const vec4f_t &b, float *out);
 
-vec3f_t operator/(const vec3f_t &a,
-                  const float s);
+void normalize(const uint32_t num, const vec3f_t *in, vec3f_t *out);
 
 } // namespace math
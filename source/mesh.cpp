@@ -0,0 +1,404 @@
+#include <cmath>
+#include <cstdint>
+
+#include <algorithm>
+#include <array>
+
+#include "mesh.h"
+
+using namespace math;
+
+namespace {
+
+// signed 16bit fixed point in [-1, 1]
+uint32_t snorm16(float v) {
+  const float c = std::min(1.f, std::max(-1.f, v));
+  return uint32_t(int32_t(lrintf(c * 32767.f))) & 0xffff;
+}
+
+float from_snorm16(uint32_t v) {
+  return float(int16_t(uint16_t(v))) * (1.f / 32767.f);
+}
+
+// project onto the octahedron |x| + |y| + |z| = 1 and fold the lower half
+// over the upper
+uint32_t oct_encode(const vec3f_t &n) {
+  const float l = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+  if (l <= 0.f) {
+    return 0;
+  }
+  float x = n.x / l, y = n.y / l;
+  if (n.z < 0.f) {
+    const float fx = (1.f - fabsf(y)) * (x >= 0.f ? 1.f : -1.f);
+    const float fy = (1.f - fabsf(x)) * (y >= 0.f ? 1.f : -1.f);
+    x = fx;
+    y = fy;
+  }
+  return snorm16(x) | (snorm16(y) << 16);
+}
+
+vec3f_t oct_decode(uint32_t v) {
+  const float x = from_snorm16(v), y = from_snorm16(v >> 16);
+  const float z = 1.f - fabsf(x) - fabsf(y);
+  // unfold the lower half
+  const float t = std::max(-z, 0.f);
+  vec3f_t n = {x + (x >= 0.f ? -t : t), y + (y >= 0.f ? -t : t), z};
+  return vec3f_t::normalize(n);
+}
+
+// spread the low 10 bits of v out to every third bit
+uint32_t spread3(uint32_t v) {
+  v &= 0x3ff;
+  v = (v | (v << 16)) & 0x030000ff;
+  v = (v | (v << 8)) & 0x0300f00f;
+  v = (v | (v << 4)) & 0x030c30c3;
+  v = (v | (v << 2)) & 0x09249249;
+  return v;
+}
+
+} // namespace {}
+
+void mesh_t::load(const float *xyz,
+                  uint32_t num_floats,
+                  const uint32_t *in_index,
+                  uint32_t num_index) {
+  const vec3f_t *v = (const vec3f_t *)xyz;
+  pos.assign(v, v + num_floats / 3);
+  index.assign(in_index, in_index + num_index);
+  calc_normals();
+}
+
+void mesh_t::calc_normals() {
+  ++version;
+  normal.assign(pos.size(), vec3f_t{0.f, 0.f, 0.f});
+
+  for (size_t i = 0; i + 2 < index.size(); i += 3) {
+    const uint32_t i0 = index[i + 0];
+    const uint32_t i1 = index[i + 1];
+    const uint32_t i2 = index[i + 2];
+    // unnormalized so larger faces have more influence
+    const vec3f_t n = vec3f_t::cross(pos[i2] - pos[i0], pos[i1] - pos[i0]);
+    normal[i0] += n;
+    normal[i1] += n;
+    normal[i2] += n;
+  }
+
+  for (vec3f_t &n : normal) {
+    if ((n * n) > 0.f) {
+      n = vec3f_t::normalize(n);
+    }
+  }
+}
+
+void mesh_t::sort_back_to_front(const vec4f_t *screen,
+                                std::vector<uint32_t> &order) const {
+  const uint32_t num_tris = uint32_t(index.size() / 3);
+  std::vector<std::pair<float, uint32_t>> key(num_tris);
+  for (uint32_t i = 0; i < num_tris; ++i) {
+    const uint32_t *t = index.data() + i * 3;
+    key[i].first = screen[t[0]].w + screen[t[1]].w + screen[t[2]].w;
+    key[i].second = i * 3;
+  }
+  std::sort(key.begin(), key.end(),
+            [](const std::pair<float, uint32_t> &a,
+               const std::pair<float, uint32_t> &b) {
+              return a.first > b.first;
+            });
+  order.resize(num_tris);
+  for (uint32_t i = 0; i < num_tris; ++i) {
+    order[i] = key[i].second;
+  }
+}
+
+void mesh_t::sort_spatial() {
+  const uint32_t num_tris = uint32_t(index.size() / 3);
+  if (num_tris == 0) {
+    return;
+  }
+
+  // centroids quantized to 10 bits a side of the bounding box
+  vec3f_t lo = pos[index[0]], hi = lo;
+  for (const uint32_t i : index) {
+    const vec3f_t &p = pos[i];
+    lo = vec3f_t{std::min(lo.x, p.x), std::min(lo.y, p.y),
+                 std::min(lo.z, p.z)};
+    hi = vec3f_t{std::max(hi.x, p.x), std::max(hi.y, p.y),
+                 std::max(hi.z, p.z)};
+  }
+  const float extent = std::max(hi.x - lo.x, std::max(hi.y - lo.y,
+                                                      hi.z - lo.z));
+  const float scale = (extent > 0.f) ? 1023.f / (extent * 3.f) : 0.f;
+
+  std::vector<std::pair<uint32_t, uint32_t>> key(num_tris);
+  for (uint32_t t = 0; t < num_tris; ++t) {
+    const uint32_t *i = index.data() + t * 3;
+    const vec3f_t c = (pos[i[0]] + pos[i[1]] + pos[i[2]]) - lo * 3.f;
+    key[t].first = spread3(uint32_t(c.x * scale)) |
+                   (spread3(uint32_t(c.y * scale)) << 1) |
+                   (spread3(uint32_t(c.z * scale)) << 2);
+    key[t].second = t;
+  }
+  // stable so triangles in one cell keep their order
+  std::stable_sort(key.begin(), key.end(),
+                   [](const std::pair<uint32_t, uint32_t> &a,
+                      const std::pair<uint32_t, uint32_t> &b) {
+                     return a.first < b.first;
+                   });
+
+  const std::vector<uint32_t> old = index;
+  for (uint32_t t = 0; t < num_tris; ++t) {
+    const uint32_t *i = old.data() + key[t].second * 3;
+    std::copy(i, i + 3, index.begin() + t * 3);
+  }
+  ++version;
+}
+
+void mesh_t::stripify(std::vector<uint32_t> &strips) const {
+  const uint32_t num_tris = uint32_t(index.size() / 3);
+
+  const auto key = [](uint32_t a, uint32_t b) {
+    return (a < b) ? ((uint64_t(a) << 32) | b) : ((uint64_t(b) << 32) | a);
+  };
+
+  // every edge with its triangle, sorted so the triangles around an edge
+  // can be found with a binary search
+  typedef std::pair<uint64_t, uint32_t> edge_t;
+  std::vector<edge_t> edges;
+  edges.reserve(num_tris * 3);
+  for (uint32_t t = 0; t < num_tris; ++t) {
+    const uint32_t *i = index.data() + t * 3;
+    edges.emplace_back(key(i[0], i[1]), t);
+    edges.emplace_back(key(i[1], i[2]), t);
+    edges.emplace_back(key(i[2], i[0]), t);
+  }
+  std::sort(edges.begin(), edges.end());
+
+  std::vector<uint8_t> used(num_tris, 0);
+  // triangles taken by the strip being grown
+  std::vector<uint32_t> stamp(num_tris, 0);
+  uint32_t cur = 0;
+
+  // find a free triangle wound p -> q -> r
+  const auto find = [&](uint32_t p, uint32_t q, uint32_t &tri, uint32_t &r) {
+    auto it = std::lower_bound(edges.begin(), edges.end(),
+                               edge_t{key(p, q), 0});
+    for (; it != edges.end() && it->first == key(p, q); ++it) {
+      const uint32_t t = it->second;
+      if (used[t] || stamp[t] == cur) {
+        continue;
+      }
+      const uint32_t *i = index.data() + t * 3;
+      for (uint32_t k = 0; k < 3; ++k) {
+        if (i[k] == p && i[(k + 1) % 3] == q) {
+          tri = t;
+          r = i[(k + 2) % 3];
+          return true;
+        }
+      }
+    }
+    return false;
+  };
+
+  // grow a strip from a triangle starting at one of its corners, its
+  // triangles are listed in tris
+  std::vector<uint32_t> strip, tris;
+  const auto grow = [&](uint32_t t, uint32_t corner) {
+    ++cur;
+    const uint32_t *i = index.data() + t * 3;
+    strip.assign({i[corner], i[(corner + 1) % 3], i[(corner + 2) % 3]});
+    tris.assign({t});
+    stamp[t] = cur;
+    for (;;) {
+      // the next triangle starts at strip[j], odd ones are wound backwards
+      const size_t j = strip.size() - 2;
+      const uint32_t x = strip[j], y = strip[j + 1];
+      uint32_t tri, r;
+      if (!find((j & 1) ? y : x, (j & 1) ? x : y, tri, r)) {
+        break;
+      }
+      stamp[tri] = cur;
+      tris.push_back(tri);
+      strip.push_back(r);
+    }
+  };
+
+  strips.clear();
+  for (uint32_t t = 0; t < num_tris; ++t) {
+    if (used[t]) {
+      continue;
+    }
+    // keep whichever corner gives the longest strip
+    uint32_t best = 0;
+    size_t best_size = 0;
+    for (uint32_t corner = 0; corner < 3; ++corner) {
+      grow(t, corner);
+      if (strip.size() > best_size) {
+        best_size = strip.size();
+        best = corner;
+      }
+    }
+    grow(t, best);
+    for (const uint32_t u : tris) {
+      used[u] = 1;
+    }
+    if (!strips.empty()) {
+      strips.push_back(restart_index);
+    }
+    strips.insert(strips.end(), strip.begin(), strip.end());
+  }
+}
+
+void mesh_t::polygonize(std::vector<uint32_t> &polys) const {
+  const uint32_t num_tris = uint32_t(index.size() / 3);
+
+  // the cosine between face normals above which a pair is merged. the
+  // rasterizer fits its planes over all of a polygon's vertices so they
+  // need to be close to coplanar.
+  const float flat = .999f;
+
+  const auto key = [](uint32_t a, uint32_t b) {
+    return (a < b) ? ((uint64_t(a) << 32) | b) : ((uint64_t(b) << 32) | a);
+  };
+
+  typedef std::pair<uint64_t, uint32_t> edge_t;
+  std::vector<edge_t> edges;
+  edges.reserve(num_tris * 3);
+  std::vector<vec3f_t> face(num_tris);
+  for (uint32_t t = 0; t < num_tris; ++t) {
+    const uint32_t *i = index.data() + t * 3;
+    edges.emplace_back(key(i[0], i[1]), t);
+    edges.emplace_back(key(i[1], i[2]), t);
+    edges.emplace_back(key(i[2], i[0]), t);
+    const vec3f_t n = vec3f_t::cross(pos[i[2]] - pos[i[0]],
+                                     pos[i[1]] - pos[i[0]]);
+    face[t] = ((n * n) > 0.f) ? vec3f_t::normalize(n) : n;
+  }
+  std::sort(edges.begin(), edges.end());
+
+  // a quad is convex when each corner turns the same way as the first
+  const auto convex = [&](const std::array<uint32_t, 4> &q) {
+    vec3f_t first = {0.f, 0.f, 0.f};
+    for (uint32_t k = 0; k < 4; ++k) {
+      const vec3f_t &a = pos[q[k]], &b = pos[q[(k + 1) % 4]],
+                    &c = pos[q[(k + 2) % 4]];
+      const vec3f_t turn = vec3f_t::cross(b - a, c - b);
+      if (k == 0) {
+        first = turn;
+      } else if ((turn * first) <= 0.f) {
+        return false;
+      }
+    }
+    return true;
+  };
+
+  std::vector<uint8_t> used(num_tris, 0);
+  polys.clear();
+  for (uint32_t t = 0; t < num_tris; ++t) {
+    if (used[t]) {
+      continue;
+    }
+    used[t] = 1;
+    const uint32_t *i = index.data() + t * 3;
+
+    // the flattest free neighbour wound q -> p across edge p -> q
+    float best = flat;
+    uint32_t best_tri = t;
+    std::array<uint32_t, 4> quad = {0, 0, 0, 0};
+    for (uint32_t k = 0; k < 3; ++k) {
+      const uint32_t p = i[k], q = i[(k + 1) % 3], r = i[(k + 2) % 3];
+      auto it = std::lower_bound(edges.begin(), edges.end(),
+                                 edge_t{key(p, q), 0});
+      for (; it != edges.end() && it->first == key(p, q); ++it) {
+        const uint32_t u = it->second;
+        if (used[u] || (face[u] * face[t]) <= best) {
+          continue;
+        }
+        const uint32_t *j = index.data() + u * 3;
+        for (uint32_t m = 0; m < 3; ++m) {
+          if (j[m] == q && j[(m + 1) % 3] == p) {
+            const std::array<uint32_t, 4> c = {p, j[(m + 2) % 3], q, r};
+            if (convex(c)) {
+              best = face[u] * face[t];
+              best_tri = u;
+              quad = c;
+            }
+          }
+        }
+      }
+    }
+
+    if (!polys.empty()) {
+      polys.push_back(restart_index);
+    }
+    if (best_tri != t) {
+      used[best_tri] = 1;
+      polys.insert(polys.end(), quad.begin(), quad.end());
+    } else {
+      polys.insert(polys.end(), i, i + 3);
+    }
+  }
+}
+
+void packed_mesh_t::pack(const mesh_t &mesh) {
+  vec3f_t lo = {0.f, 0.f, 0.f}, hi = {0.f, 0.f, 0.f};
+  if (!mesh.pos.empty()) {
+    lo = hi = mesh.pos[0];
+  }
+  for (const vec3f_t &p : mesh.pos) {
+    for (int i = 0; i < 3; ++i) {
+      lo.e[i] = std::min(lo.e[i], p.e[i]);
+      hi.e[i] = std::max(hi.e[i], p.e[i]);
+    }
+  }
+  bias = lo;
+  for (int i = 0; i < 3; ++i) {
+    scale.e[i] = std::max(hi.e[i] - lo.e[i], 1e-6f) / 65535.f;
+  }
+
+  pos.resize(mesh.pos.size());
+  for (size_t j = 0; j < pos.size(); ++j) {
+    uint16_t q[3];
+    for (int i = 0; i < 3; ++i) {
+      const float f = (mesh.pos[j].e[i] - bias.e[i]) / scale.e[i];
+      q[i] = uint16_t(std::min(65535.f, std::max(0.f, f + .5f)));
+    }
+    pos[j] = vec3u16_t{q[0], q[1], q[2]};
+  }
+
+  normal.resize(mesh.normal.size());
+  for (size_t j = 0; j < normal.size(); ++j) {
+    normal[j] = oct_encode(mesh.normal[j]);
+  }
+
+  if (!pack_index(mesh.index, index)) {
+    index.clear();
+  }
+}
+
+bool packed_mesh_t::pack_index(const std::vector<uint32_t> &in,
+                               std::vector<uint16_t> &out) const {
+  // the largest index is kept free for restarts
+  if (num_vertex() > restart_index16) {
+    return false;
+  }
+  out.resize(in.size());
+  for (size_t i = 0; i < in.size(); ++i) {
+    out[i] = (in[i] == restart_index) ? restart_index16 : uint16_t(in[i]);
+  }
+  return true;
+}
+
+matrix_t packed_mesh_t::dequantize() const {
+  matrix_t m;
+  m.identity();
+  m.scale(scale);
+  m.translate(bias);
+  return m;
+}
+
+void packed_mesh_t::unpack_normals(uint32_t i0, uint32_t i1,
+                                   vec3f_t *out) const {
+  for (uint32_t i = i0; i < i1; ++i) {
+    out[i - i0] = oct_decode(normal[i]);
+  }
+}
@@ -0,0 +1,91 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "math.h"
+
+// an index that ends one strip or fan and starts the next
+const uint32_t restart_index = 0xffffffff;
+
+// an indexed triangle list with per vertex normals
+struct mesh_t {
+
+  mesh_t()
+    : version(0)
+  {
+  }
+
+  // load from a flat xyz float array and a triangle index list, smooth
+  // normals are computed here once rather than every frame
+  void load(const float *xyz,
+            uint32_t num_floats,
+            const uint32_t *index,
+            uint32_t num_index);
+
+  // area weighted average of the face normals around each vertex
+  void calc_normals();
+
+  // order triangles far to near by the mean w of their projected vertices,
+  // for drawing translucent geometry
+  void sort_back_to_front(const math::vec4f_t *screen,
+                          std::vector<uint32_t> &order) const;
+
+  // reorder the triangle list along a morton curve through the object
+  // space centroids, so triangles drawn one after another land near each
+  // other on screen and share pixels, tiles and cache lines. opaque draws
+  // are unchanged with a depth buffer or hidden surface mode, only
+  // painter's order without depth depends on the original order.
+  void sort_spatial();
+
+  // convert the triangle list into strips joined by restart_index. strips
+  // are grown greedily across shared edges keeping the original winding,
+  // which is flipped on every odd triangle of a strip.
+  void stripify(std::vector<uint32_t> &strips) const;
+
+  // merge pairs of triangles across shared edges into convex quads where
+  // they are flat enough, giving polygons joined by restart_index. the
+  // rest are left as triangles.
+  void polygonize(std::vector<uint32_t> &polys) const;
+
+  uint32_t num_vertex() const {
+    return uint32_t(pos.size());
+  }
+
+  std::vector<math::vec3f_t> pos;
+  std::vector<math::vec3f_t> normal;
+  std::vector<uint32_t> index;
+  // bumped whenever the mesh changes
+  uint32_t version;
+};
+
+// a mesh packed for vertex fetch. positions are 16bit fractions of the
+// bounding box, half the size of floats, with normals octahedral encoded
+// into 32bits and 16bit indices when the vertex count allows.
+struct packed_mesh_t {
+
+  static const uint16_t restart_index16 = 0xffff;
+
+  void pack(const mesh_t &mesh);
+
+  // pack an index list or restart joined strips, when it fits in 16bits
+  bool pack_index(const std::vector<uint32_t> &in,
+                  std::vector<uint16_t> &out) const;
+
+  // maps packed positions back into object space. multiply it on last so
+  // that it is applied first and dequantizing costs nothing extra.
+  math::matrix_t dequantize() const;
+
+  // decode normals i0 to i1 into out
+  void unpack_normals(uint32_t i0, uint32_t i1, math::vec3f_t *out) const;
+
+  uint32_t num_vertex() const {
+    return uint32_t(pos.size());
+  }
+
+  std::vector<math::vec3u16_t> pos;
+  std::vector<uint32_t> normal;
+  // empty if there are too many vertices, use the mesh_t indices then
+  std::vector<uint16_t> index;
+  // object space size of one step and the box minimum
+  math::vec3f_t scale, bias;
+};
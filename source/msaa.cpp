@@ -0,0 +1,80 @@
+#include <cstdint>
+#include <cstring>
+
+#include <algorithm>
+
+#include <emmintrin.h>
+
+#include "msaa.h"
+
+namespace {
+
+// standard rotated sample patterns, in 1/16th of a pixel
+const int8_t pattern_4[4][2] = {
+    {-2, -6}, {6, -2}, {-6, 2}, {2, 6}};
+
+const int8_t pattern_8[8][2] = {
+    {1, -3}, {-1, 3}, {5, 1}, {-3, -5}, {-5, 5}, {-7, -1}, {3, 7}, {7, -7}};
+
+} // namespace {}
+
+void msaa_target_t::init(uint32_t width, uint32_t height, uint32_t samples) {
+  width_ = width;
+  height_ = height;
+  samples_per_ = (samples == 8) ? 8 : 4;
+  full_ = (1u << samples_per_) - 1;
+
+  const int8_t(*pattern)[2] = (samples_per_ == 8) ? pattern_8 : pattern_4;
+  for (uint32_t i = 0; i < samples_per_; ++i) {
+    off_x_[i] = float(pattern[i][0]) / 16.f;
+    off_y_[i] = float(pattern[i][1]) / 16.f;
+  }
+
+  colour_.assign(width * height, 0);
+  expanded_.assign(width * height, 0);
+  samples_.resize(width * height * samples_per_);
+}
+
+void msaa_target_t::clear(uint32_t rgb) {
+  std::fill(colour_.begin(), colour_.end(), rgb);
+  memset(expanded_.data(), 0, expanded_.size());
+}
+
+void msaa_target_t::resolve(framebuffer_t &fb) const {
+  const __m128i zero = _mm_setzero_si128();
+  const int shift = (samples_per_ == 8) ? 3 : 2;
+  // rounding bias for the average
+  const __m128i bias = _mm_set1_epi16(int16_t(samples_per_ >> 1));
+
+  std::vector<uint32_t> line(width_);
+  for (uint32_t y = 0; y < height_; ++y) {
+    const uint32_t row = y * width_;
+    // resolve straight into linear 32bit targets
+    uint32_t *out =
+        (fb.format == PIXEL_RGBA8 && fb.layout == LAYOUT_LINEAR)
+            ? (uint32_t *)fb.row(y)
+            : line.data();
+    for (uint32_t x = 0; x < width_; ++x) {
+      const uint32_t p = row + x;
+      if (!expanded_[p]) {
+        out[x] = colour_[p];
+        continue;
+      }
+      // sum the samples in 16bit lanes, four samples per load
+      const __m128i *s = (const __m128i *)(samples_.data() + p * samples_per_);
+      __m128i acc = zero;
+      for (uint32_t i = 0; i < samples_per_; i += 4) {
+        const __m128i v = _mm_loadu_si128(s++);
+        acc = _mm_add_epi16(acc, _mm_unpacklo_epi8(v, zero));
+        acc = _mm_add_epi16(acc, _mm_unpackhi_epi8(v, zero));
+      }
+      // fold the two pixels in each half together
+      acc = _mm_add_epi16(acc, _mm_srli_si128(acc, 8));
+      acc = _mm_srli_epi16(_mm_add_epi16(acc, bias), shift);
+      out[x] = uint32_t(_mm_cvtsi128_si32(_mm_packus_epi16(acc, zero)));
+    }
+    if (out == line.data()) {
+      fb.store(y, 0, width_, out);
+    }
+  }
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "framebuffer.h"
+
+// multisample render target. a pixel is either compressed, holding one
+// colour for all of its samples, or expanded into per sample colours. only
+// pixels on triangle edges ever need to be expanded.
+struct msaa_target_t {
+
+  // samples must be 4 or 8
+  void init(uint32_t width, uint32_t height, uint32_t samples);
+
+  // reset every pixel to a single compressed colour
+  void clear(uint32_t rgb);
+
+  // write a colour to the samples of a pixel selected by mask
+  void write(uint32_t x, uint32_t y, uint32_t rgb, uint32_t mask) {
+    const uint32_t p = x + y * width_;
+    if (mask == full_) {
+      colour_[p] = rgb;
+      expanded_[p] = 0;
+      return;
+    }
+    uint32_t *s = samples_.data() + p * samples_per_;
+    if (!expanded_[p]) {
+      for (uint32_t i = 0; i < samples_per_; ++i) {
+        s[i] = colour_[p];
+      }
+      expanded_[p] = 1;
+    }
+    for (; mask; mask &= mask - 1) {
+      s[ctz(mask)] = rgb;
+    }
+  }
+
+  // average the samples of each pixel into a framebuffer of the same size
+  void resolve(framebuffer_t &fb) const;
+
+  uint32_t width() const {
+    return width_;
+  }
+
+  uint32_t height() const {
+    return height_;
+  }
+
+  uint32_t samples() const {
+    return samples_per_;
+  }
+
+  // sample offsets from the pixel center
+  const float *offset_x() const {
+    return off_x_;
+  }
+
+  const float *offset_y() const {
+    return off_y_;
+  }
+
+protected:
+  static uint32_t ctz(uint32_t v) {
+    uint32_t n = 0;
+    for (; !(v & 1); v >>= 1) {
+      ++n;
+    }
+    return n;
+  }
+
+  uint32_t width_, height_;
+  uint32_t samples_per_, full_;
+  float off_x_[8], off_y_[8];
+  std::vector<uint32_t> colour_;
+  std::vector<uint8_t> expanded_;
+  std::vector<uint32_t> samples_;
+};
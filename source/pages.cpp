@@ -0,0 +1,50 @@
+#include <cstdlib>
+#include <cstring>
+
+#if defined(_WIN32)
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#include "pages.h"
+
+void page_buffer_t::assign(size_t size) {
+  release();
+  if (size == 0) {
+    return;
+  }
+  // cache line aligned for the simd paths, huge page aligned when big
+  const size_t align = (size >= huge_page) ? huge_page : 64;
+  const size_t padded = (size + align - 1) & ~(align - 1);
+  void *p = nullptr;
+#if defined(_WIN32)
+  // large pages need a privilege most users lack, so just align
+  p = _aligned_malloc(padded, align);
+#else
+  if (posix_memalign(&p, align, padded)) {
+    p = nullptr;
+  }
+#if defined(MADV_HUGEPAGE)
+  if (p && align == huge_page) {
+    madvise(p, padded, MADV_HUGEPAGE);
+  }
+#endif
+#endif
+  if (!p) {
+    abort();
+  }
+  memset(p, 0, size);
+  data_ = (uint8_t *)p;
+  size_ = size;
+}
+
+void page_buffer_t::release() {
+#if defined(_WIN32)
+  _aligned_free(data_);
+#else
+  free(data_);
+#endif
+  data_ = nullptr;
+  size_ = 0;
+}
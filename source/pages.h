@@ -0,0 +1,45 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// zeroed memory for large surfaces. anything of 2MB or more is aligned to
+// and, where the os allows, backed by 2MB pages so a whole surface needs
+// only a handful of tlb entries.
+struct page_buffer_t {
+
+  static const size_t huge_page = 2 * 1024 * 1024;
+
+  page_buffer_t()
+    : data_(nullptr)
+    , size_(0)
+  {
+  }
+
+  ~page_buffer_t() {
+    release();
+  }
+
+  page_buffer_t(const page_buffer_t &) = delete;
+  page_buffer_t &operator=(const page_buffer_t &) = delete;
+
+  // reallocate as size zeroed bytes
+  void assign(size_t size);
+
+  void release();
+
+  uint8_t *data() const {
+    return data_;
+  }
+
+  size_t size() const {
+    return size_;
+  }
+
+  bool empty() const {
+    return size_ == 0;
+  }
+
+protected:
+  uint8_t *data_;
+  size_t size_;
+};
@@ -0,0 +1,84 @@
+#pragma once
+#include <array>
+#include <cstdint>
+
+#include "blend.h"
+#include "framebuffer.h"
+#include "hsr.h"
+#include "jobs.h"
+#include "math.h"
+#include "msaa.h"
+#include "texture.h"
+#include "visbuf.h"
+
+// per triangle entry points into the rasterizer, used inside the library.
+// applications submit whole batches through scanline.h instead.
+
+// share edge setup between the triangles of a batch drawn on this thread.
+// while one is alive, triangles and polygons given their vertex indices in
+// the batch set each edge up once, found again by its pair of indices.
+// screen positions must not change while it lives.
+struct edge_scope_t {
+  edge_scope_t();
+  ~edge_scope_t();
+};
+
+void draw_line(framebuffer_t *, math::vec2f_t, math::vec2f_t, uint32_t rgb);
+void draw_tri(framebuffer_t *, const std::array<math::vec4f_t, 3> &,
+              uint32_t rgb, const blend_t &,
+              const std::array<uint32_t, 3> *index = nullptr);
+void draw_tri_tex(framebuffer_t *, const std::array<math::vec4f_t, 3> &,
+                  const std::array<math::vec2f_t, 3> &uv, const texture_t &,
+                  tex_filter_t filter, const blend_t &,
+                  const std::array<uint32_t, 3> *index = nullptr);
+void draw_tri_gouraud(framebuffer_t *, const std::array<math::vec4f_t, 3> &,
+                      const std::array<uint32_t, 3> &rgb, const blend_t &,
+                      const std::array<uint32_t, 3> *index = nullptr);
+
+void draw_tri(msaa_target_t *, const std::array<math::vec4f_t, 3> &,
+              uint32_t rgb, const blend_t &,
+              const std::array<uint32_t, 3> *index = nullptr);
+void draw_tri_tex(msaa_target_t *, const std::array<math::vec4f_t, 3> &,
+                  const std::array<math::vec2f_t, 3> &uv, const texture_t &,
+                  tex_filter_t filter, const blend_t &,
+                  const std::array<uint32_t, 3> *index = nullptr);
+void draw_tri_gouraud(msaa_target_t *, const std::array<math::vec4f_t, 3> &,
+                      const std::array<uint32_t, 3> &rgb, const blend_t &,
+                      const std::array<uint32_t, 3> *index = nullptr);
+
+// convex polygons of up to max_poly_verts vertices, wound like triangles.
+// each scanline is filled once instead of once per triangle of a fan.
+const uint32_t max_poly_verts = 16;
+
+void draw_poly(framebuffer_t *, const math::vec4f_t *, uint32_t n,
+               uint32_t rgb, const blend_t &,
+               const uint32_t *index = nullptr);
+void draw_poly_tex(framebuffer_t *, const math::vec4f_t *, uint32_t n,
+                   const math::vec2f_t *uv, const texture_t &,
+                   tex_filter_t filter, const blend_t &,
+                   const uint32_t *index = nullptr);
+void draw_poly_gouraud(framebuffer_t *, const math::vec4f_t *, uint32_t n,
+                       const uint32_t *rgb, const blend_t &,
+                       const uint32_t *index = nullptr);
+
+void draw_poly(msaa_target_t *, const math::vec4f_t *, uint32_t n,
+               uint32_t rgb, const blend_t &,
+               const uint32_t *index = nullptr);
+void draw_poly_tex(msaa_target_t *, const math::vec4f_t *, uint32_t n,
+                   const math::vec2f_t *uv, const texture_t &,
+                   tex_filter_t filter, const blend_t &,
+                   const uint32_t *index = nullptr);
+void draw_poly_gouraud(msaa_target_t *, const math::vec4f_t *, uint32_t n,
+                       const uint32_t *rgb, const blend_t &,
+                       const uint32_t *index = nullptr);
+
+// shade the nearest surface at each pixel from batches in id order. with
+// fill every other pixel is set to bg, otherwise they are left alone.
+void draw_vis(visbuf_t *, const std::array<math::vec4f_t, 3> &, uint32_t id,
+              const std::array<uint32_t, 3> *index = nullptr);
+void shade_vis(framebuffer_t *, const visbuf_t &, const vis_batch_t *,
+               uint32_t num_batches, uint32_t bg, bool fill, jobs_t *);
+
+void draw_hsr(hsr_t *, const std::array<math::vec4f_t, 3> &, uint32_t id);
+void shade_vis(framebuffer_t *, hsr_t &, const vis_batch_t *,
+               uint32_t num_batches, uint32_t bg, bool fill, jobs_t *);
@@ -1,11 +1,21 @@
-#define _SDL_main_h
-#include <SDL.h>
-
+#include <algorithm>
 #include <array>
 #include <cassert>
+#include <cmath>
 #include <cstdint>
-
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include "blend.h"
+#include "hsr.h"
+#include "jobs.h"
+#include "framebuffer.h"
 #include "math.h"
+#include "msaa.h"
+#include "raster.h"
+#include "texture.h"
+#include "visbuf.h"
 
 using namespace math;
 
@@ -92,13 +102,9 @@ constexpr float dot(const vec2f_t &a, const vec2f_t &b) {
 }
 
 // plot a pixel to the screen
-void plot(SDL_Surface *surf, int32_t x, int32_t y, uint32_t rgb = 0xdadada) {
-  assert(surf);
-  if (x < 0.f || y < 0.f || x >= surf->w || y >= surf->h) {
-    return;
-  }
-  uint32_t *pix = (uint32_t *)surf->pixels;
-  pix[x + y * surf->w] = rgb;
+void plot(framebuffer_t *fb, int32_t x, int32_t y, uint32_t rgb = 0xdadada) {
+  assert(fb);
+  fb->plot(x, y, rgb);
 }
 
 constexpr int32_t minv(int32_t a, int32_t b) { return a < b ? a : b; }
@@ -111,18 +117,46 @@ constexpr int32_t clampv(int32_t lo, int32_t v, int32_t hi) {
 
 enum clip_span_t { CLIP_SPAN_MIN_X, CLIP_SPAN_MAX_X };
 
-template <clip_span_t CLIP, size_t SIZE>
-void scan_convert(vec2f_t a, vec2f_t b, std::array<int32_t, SIZE> &span) {
+// per thread buffers that grow to the largest target drawn so far, one
+// per slot
+template <typename type_t, int SLOT>
+type_t *scratch(size_t n) {
+  thread_local std::vector<type_t> buf;
+  if (buf.size() < n) {
+    buf.resize(n);
+  }
+  return buf.data();
+}
 
-  // XXX: move into global attribute
-  static const int32_t screen_w = 511;
-  static const int32_t screen_h = 511;
+// the last column and row of the target triangles are clipped to
+struct raster_bounds_t {
+  int32_t max_x, max_y;
+};
+
+// a set up edge, x is 16.16 fixed point at row y0
+struct edge_setup_t {
+  // end points, sorted in y
+  vec2f_t a, b;
+  // the last row it was clipped to
+  int32_t max_y;
+  int32_t y0, y1;
+  int32_t x, dx;
+};
+
+// set up an edge for scan conversion, rows y0 > y1 when nothing is covered
+void setup_edge(vec2f_t a, vec2f_t b, int32_t screen_h, edge_setup_t &e) {
+
+  e.a = a;
+  e.b = b;
+  e.max_y = screen_h;
+  e.y0 = 1;
+  e.y1 = 0;
 
   // assume our vertices are pre-sorted
   __assume(a.y < b.y);
 
   // scanline rejection
-  if (b.y < 0.f || a.y > screen_h) {
+  if (b.y < 0.f || a.y > float(screen_h)) {
     return;
   }
 
@@ -143,36 +177,618 @@ void scan_convert(vec2f_t a, vec2f_t b, std::array<int32_t, SIZE> &span) {
     a.y = ceily;
   }
 
-  const int32_t iay = maxv(int32_t(a.y), 0);
-  const int32_t iby = minv(int32_t(b.y), screen_h);
+  e.y0 = maxv(int32_t(a.y), 0);
+  e.y1 = minv(int32_t(b.y), screen_h);
 
-  int32_t x = int32_t(a.x * float(0x10000));
-  const int32_t idx = int32_t(dx * float(0x10000));
+  e.x = int32_t(a.x * float(0x10000));
+  e.dx = int32_t(dx * float(0x10000));
+}
+
+template <clip_span_t CLIP>
+void scan_convert(const edge_setup_t &e, int32_t *span, int32_t screen_w) {
 
+  int32_t x = e.x;
   switch (CLIP) {
   case CLIP_SPAN_MAX_X:
-    for (int32_t y = iay; y <= iby; ++y, x += idx) {
+    for (int32_t y = e.y0; y <= e.y1; ++y, x += e.dx) {
       span[y] = std::max<int32_t>(x >> 16, 0);
     }
     break;
   case CLIP_SPAN_MIN_X:
-    for (int32_t y = iay; y <= iby; ++y, x += idx) {
+    for (int32_t y = e.y0; y <= e.y1; ++y, x += e.dx) {
       span[y] = std::min<int32_t>(x >> 16, screen_w);
     }
     break;
   }
 }
 
-// scan convert a triangle
-bool scan_triangle(SDL_Surface *surf, std::array<vec2f_t, 3> v, uint32_t rgb) {
+// edges set up during an edge_scope_t, found by their pair of vertex
+// indices. almost every edge of a closed mesh is in two triangles, which
+// are usually drawn near each other but not one after the other. the cache
+// is direct mapped and small enough to stay in cache itself, a miss only
+// costs a setup.
+struct edge_cache_t {
+
+  static const uint32_t size = 4096;
+
+  // only what scan_convert reads, so a slot fits in half a cache line
+  struct slot_t {
+    uint32_t i0, i1;
+    // the scope that set it up, older slots are free
+    uint32_t stamp;
+    int32_t y0, y1, x, dx;
+  };
+
+  void begin() {
+    if (slots.empty()) {
+      slots.assign(size, slot_t{0, 0, 0, 0, 0, 0, 0});
+      stamp = 0;
+    }
+    if (++stamp == 0) {
+      for (slot_t &slot : slots) {
+        slot.stamp = 0;
+      }
+      stamp = 1;
+    }
+    max_y = -1;
+    active = true;
+  }
+
+  void get(uint32_t ia, uint32_t ib, const vec2f_t &a, const vec2f_t &b,
+           int32_t screen_h, edge_setup_t &e) {
+    // edges are only shared within one target
+    if (screen_h != max_y) {
+      if (max_y >= 0) {
+        begin();
+      }
+      max_y = screen_h;
+    }
+    const uint32_t i0 = std::min(ia, ib), i1 = std::max(ia, ib);
+    // placed by the lower index so a mesh drawn roughly in vertex order
+    // keeps a window of its recent edges
+    slot_t &slot =
+        slots[(i0 * 4 + ((i1 * 0x9e3779b1u) >> 30)) & (size - 1)];
+    if (slot.stamp == stamp && slot.i0 == i0 && slot.i1 == i1) {
+      e.max_y = screen_h;
+      e.y0 = slot.y0;
+      e.y1 = slot.y1;
+      e.x = slot.x;
+      e.dx = slot.dx;
+      return;
+    }
+    setup_edge(a, b, screen_h, e);
+    slot = slot_t{i0, i1, stamp, e.y0, e.y1, e.x, e.dx};
+  }
+
+  std::vector<slot_t> slots;
+  uint32_t stamp;
+  int32_t max_y;
+  bool active;
+};
+
+thread_local edge_cache_t edge_cache = {};
+
+edge_scope_t::edge_scope_t() {
+  edge_cache.begin();
+}
+
+edge_scope_t::~edge_scope_t() {
+  edge_cache.active = false;
+}
+
+// a screen space linear attribute, value = c + x * dx + y * dy
+struct gradient_t {
+
+  gradient_t() = default;
+
+  // solve the attribute plane passing through three vertices
+  gradient_t(const std::array<vec2f_t, 3> &v, float a0, float a1, float a2) {
+    const float x1 = v[1].x - v[0].x, y1 = v[1].y - v[0].y;
+    const float x2 = v[2].x - v[0].x, y2 = v[2].y - v[0].y;
+    const float ia = 1.f / (x1 * y2 - x2 * y1);
+    dx = ((a1 - a0) * y2 - (a2 - a0) * y1) * ia;
+    dy = ((a2 - a0) * x1 - (a1 - a0) * x2) * ia;
+    c = a0 - v[0].x * dx - v[0].y * dy;
+  }
+
+  // the least squares plane through n vertices, exact for three. check
+  // fits before using it for more, most attributes are not planar.
+  gradient_t(const vec2f_t *v, const float *a, uint32_t n) {
+    if (n == 3) {
+      *this = gradient_t{{v[0], v[1], v[2]}, a[0], a[1], a[2]};
+      return;
+    }
+    float mx = 0.f, my = 0.f, ma = 0.f;
+    for (uint32_t i = 0; i < n; ++i) {
+      mx += v[i].x;
+      my += v[i].y;
+      ma += a[i];
+    }
+    const float in = 1.f / float(n);
+    mx *= in;
+    my *= in;
+    ma *= in;
+    float sxx = 0.f, sxy = 0.f, syy = 0.f, sxa = 0.f, sya = 0.f;
+    for (uint32_t i = 0; i < n; ++i) {
+      const float x = v[i].x - mx, y = v[i].y - my, d = a[i] - ma;
+      sxx += x * x;
+      sxy += x * y;
+      syy += y * y;
+      sxa += x * d;
+      sya += y * d;
+    }
+    const float det = sxx * syy - sxy * sxy;
+    const float id = (det != 0.f) ? 1.f / det : 0.f;
+    dx = (sxa * syy - sya * sxy) * id;
+    dy = (sya * sxx - sxa * sxy) * id;
+    c = ma - mx * dx - my * dy;
+  }
+
+  float at(float x, float y) const {
+    return c + x * dx + y * dy;
+  }
+
+  // true when the plane passes through every vertex to within rounding, so
+  // that it matches any other polygon sharing their edges
+  bool fits(const vec2f_t *v, const float *a, uint32_t n) const {
+    float scale = 0.f;
+    for (uint32_t i = 0; i < n; ++i) {
+      scale = std::max(scale, fabsf(a[i]));
+    }
+    const float tolerance = scale * 1e-4f;
+    for (uint32_t i = 0; i < n; ++i) {
+      if (fabsf(at(v[i].x, v[i].y) - a[i]) > tolerance) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // the plane over a grid of kx by ky pixel blocks, each sampled at
+  // (ox, oy) within the block
+  gradient_t coarse(float kx, float ky, float ox, float oy) const {
+    gradient_t g;
+    g.c = at(ox, oy);
+    g.dx = dx * kx;
+    g.dy = dy * ky;
+    return g;
+  }
+
+  float c, dx, dy;
+};
+
+// flat colour span writer
+struct span_flat_t {
+
+  void operator()(uint32_t *dst, int32_t y, int32_t x0, int32_t x1) const {
+    for (int32_t x = x0; x < x1; ++x) {
+      dst[x] = rgb;
+    }
+  }
+
+  uint32_t rgb;
+};
+
+// gouraud shaded span writer
+struct span_gouraud_t {
+
+  void operator()(uint32_t *dst, int32_t y, int32_t x0, int32_t x1) const {
+    if (x0 >= x1) {
+      return;
+    }
+    const float fy = float(y);
+    const int32_t n = x1 - x0;
+
+    // 16.16 fixed point channel start and step, the span ends are clamped
+    // as they may lie slightly outside of the triangle
+    const auto setup = [&](const gradient_t &c, int32_t &v, int32_t &dv) {
+      const auto fixed = [&](float x) {
+        return std::min(std::max(c.at(x, fy), 0.f), 255.f) * float(0x10000);
+      };
+      const float s = fixed(float(x0));
+      const float e = fixed(float(x1 - 1));
+      v = int32_t(s);
+      dv = (n > 1) ? int32_t((e - s) / float(n - 1)) : 0;
+    };
+
+    int32_t ir, ig, ib, dr, dg, db;
+    setup(r, ir, dr);
+    setup(g, ig, dg);
+    setup(b, ib, db);
+
+    uint32_t *px = dst + x0;
+    for (int32_t x = x0; x < x1; ++x, ++px) {
+      *px = 0xff000000 | ((ir >> 16) << 16) | ((ig >> 16) << 8) | (ib >> 16);
+      ir += dr;
+      ig += dg;
+      ib += db;
+    }
+  }
+
+  gradient_t r, g, b;
+};
+
+// perspective correct texture mapped span writer
+template <tex_filter_t FILTER>
+struct span_tex_t {
+
+  // pixels between each perspective divide
+  static const int32_t run = 16;
+
+  void operator()(uint32_t *dst, int32_t y, int32_t x0, int32_t x1) const {
+    if (x0 >= x1) {
+      return;
+    }
+    const float fy = float(y);
+
+    // select a mip level from the uv derivatives at the center of the span
+    int32_t level = 0;
+    {
+      const float xm = float(x0 + x1) * .5f;
+      const float iq = 1.f / q.at(xm, fy);
+      const float um = u.at(xm, fy) * iq;
+      const float vm = v.at(xm, fy) * iq;
+      const float dudx = (u.dx - um * q.dx) * iq * lod_dx;
+      const float dvdx = (v.dx - vm * q.dx) * iq * lod_dx;
+      const float dudy = (u.dy - um * q.dy) * iq;
+      const float dvdy = (v.dy - vm * q.dy) * iq;
+      const float rho2 = std::max(dudx * dudx + dvdx * dvdx,
+                                  dudy * dudy + dvdy * dvdy);
+      // log2(rho) = log2(rho^2) / 2
+      if (rho2 > 1.f) {
+        level = ilogbf(rho2) >> 1;
+      }
+    }
+    const mip_t &mip = tex.mip(level);
+    // scale from base level texels to mip level 16.16 fixed point
+    const float scale = float(0x10000) * float(mip.size) / float(tex.size());
+
+    float fx = float(x0);
+    float su = u.at(fx, fy), sv = v.at(fx, fy), sq = q.at(fx, fy);
+    float iq = 1.f / sq;
+    int32_t iu = int32_t(su * iq * scale);
+    int32_t iv = int32_t(sv * iq * scale);
+
+    uint32_t *px = dst + x0;
+    for (int32_t x = x0; x < x1;) {
+
+      // perspective divide at the end of this run
+      const int32_t n = std::min(x1 - x, int32_t(run));
+      su += u.dx * n;
+      sv += v.dx * n;
+      sq += q.dx * n;
+      iq = 1.f / sq;
+      const int32_t eu = int32_t(su * iq * scale);
+      const int32_t ev = int32_t(sv * iq * scale);
+      const int32_t du = (eu - iu) / n;
+      const int32_t dv = (ev - iv) / n;
+
+      // affine between the divides
+      for (int32_t i = 0; i < n; ++i, ++px, iu += du, iv += dv) {
+        switch (FILTER) {
+        case TEX_FILTER_NEAREST:
+          *px = texture_t::sample_nearest(mip, iu, iv);
+          break;
+        case TEX_FILTER_BILINEAR:
+          *px = texture_t::sample_bilinear(mip, iu, iv);
+          break;
+        }
+      }
+      x += n;
+      iu = eu;
+      iv = ev;
+    }
+  }
+
+  const texture_t &tex;
+  // u/w, v/w and 1/w with u and v in base level texels
+  gradient_t u, v, q;
+  // scales the x derivatives when selecting a mip level, for writers that
+  // step over pixels shaded some other time
+  float lod_dx = 1.f;
+};
+
+// a span writer shading a grid of kx by ky pixel blocks, one pixel per
+// block sampled at (ox, oy) within it
+span_gouraud_t coarsen(const span_gouraud_t &s, float kx, float ky, float ox,
+                       float oy) {
+  return span_gouraud_t{s.r.coarse(kx, ky, ox, oy),
+                        s.g.coarse(kx, ky, ox, oy),
+                        s.b.coarse(kx, ky, ox, oy)};
+}
+
+// the stretched uv derivatives also select a coarser mip level to match
+template <tex_filter_t FILTER>
+span_tex_t<FILTER> coarsen(const span_tex_t<FILTER> &s, float kx, float ky,
+                           float ox, float oy) {
+  return span_tex_t<FILTER>{s.tex, s.u.coarse(kx, ky, ox, oy),
+                            s.v.coarse(kx, ky, ox, oy),
+                            s.q.coarse(kx, ky, ox, oy)};
+}
+
+// a span writer shading every kx'th pixel from ox, each sampled as the
+// one pixel it is
+span_gouraud_t stride(const span_gouraud_t &s, float kx, float ox) {
+  return coarsen(s, kx, 1.f, ox, 0.f);
+}
+
+// the mip level stays that of a single pixel
+template <tex_filter_t FILTER>
+span_tex_t<FILTER> stride(const span_tex_t<FILTER> &s, float kx, float ox) {
+  span_tex_t<FILTER> t = coarsen(s, kx, 1.f, ox, 0.f);
+  t.lod_dx = s.lod_dx / kx;
+  return t;
+}
+
+// shade a span into a row buffer then blend it over the destination
+template <blend_mode_t BLEND, typename span_t>
+struct span_blend_t {
+
+  void operator()(uint32_t *dst, int32_t y, int32_t x0, int32_t x1) const {
+    if (x0 >= x1) {
+      return;
+    }
+    uint32_t *row = scratch<uint32_t, 1>(x1);
+    span(row, y, x0, x1);
+    switch (BLEND) {
+    case BLEND_PREMUL:
+      blend_span_premul(dst + x0, row + x0, x1 - x0, opacity);
+      break;
+    case BLEND_ADD:
+      blend_span_add(dst + x0, row + x0, x1 - x0, opacity);
+      break;
+    default:
+      break;
+    }
+  }
+
+  const span_t &span;
+  uint32_t opacity;
+};
+
+// depth test a span against the framebuffer's 1/w buffer, handing only
+// the runs of visible pixels on to the span writer
+template <typename span_t>
+struct span_depth_t {
+
+  void operator()(uint32_t *dst, int32_t y, int32_t x0, int32_t x1) const {
+    float *z = fb.depth_row(y);
+    float qx = q.at(float(x0), float(y));
+    for (int32_t x = x0; x < x1;) {
+      // skip hidden pixels
+      for (; x < x1 && qx <= z[x]; ++x) {
+        qx += q.dx;
+      }
+      // write depth along the visible run
+      const int32_t start = x;
+      for (; x < x1 && qx > z[x]; ++x) {
+        z[x] = qx;
+        qx += q.dx;
+      }
+      if (start < x) {
+        span(dst, y, start, x);
+      }
+    }
+  }
+
+  const span_t &span;
+  framebuffer_t &fb;
+  gradient_t q;
+};
+
+// shade one pixel per block of the shading rate and copy it over the
+// block, coverage and depth stay per pixel. the rate is the coarser of the
+// target's and the rate map's for each tile.
+template <typename span_t>
+struct span_coarse_t {
+
+  span_coarse_t(const span_t &span, const framebuffer_t &fb)
+    : span(span)
+    , fb(fb)
+    // centre of each 2x1, 2x2 and 4x4 block
+    , blocks{{coarsen(span, 2.f, 1.f, .5f, 0.f),
+              coarsen(span, 2.f, 2.f, .5f, .5f),
+              coarsen(span, 4.f, 4.f, 1.5f, 1.5f)}}
+    , cache_rate(RATE_1X1)
+    , cache_y(-1)
+    , cache_x0(0)
+    , cache_x1(0)
+  {
+  }
+
+  void operator()(uint32_t *dst, int32_t y, int32_t x0, int32_t x1) const {
+    if (fb.rate_map.empty()) {
+      shade(fb.rate, dst, y, x0, x1);
+      return;
+    }
+    const int32_t shift = int32_t(framebuffer_t::tile_shift);
+    const uint8_t *map = fb.rate_map.data() + (y >> shift) * fb.tiles_x;
+    for (int32_t x = x0; x < x1;) {
+      const int32_t end =
+          std::min(x1, (x | int32_t(framebuffer_t::tile_size - 1)) + 1);
+      shade(std::max(fb.rate, shading_rate_t(map[x >> shift])), dst, y, x,
+            end);
+      x = end;
+    }
+  }
+
+  void shade(shading_rate_t rate, uint32_t *dst, int32_t y, int32_t x0,
+             int32_t x1) const {
+    if (rate < RATE_2X1) {
+      span(dst, y, x0, x1);
+      return;
+    }
+    static const int32_t shift_x[] = {1, 1, 2};
+    static const int32_t shift_y[] = {0, 1, 2};
+    const uint32_t i = rate - RATE_2X1;
+    const int32_t sx = shift_x[i];
+    const int32_t by = y >> shift_y[i];
+    const int32_t b0 = x0 >> sx, b1 = ((x1 - 1) >> sx) + 1;
+
+    // rows within a block share its shades, only the blocks not yet
+    // shaded for this row of blocks are done
+    uint32_t *row = scratch<uint32_t, 3>(b1);
+    if (rate != cache_rate || by != cache_y || b1 < cache_x0 ||
+        b0 > cache_x1) {
+      blocks[i](row, by, b0, b1);
+      cache_rate = rate;
+      cache_y = by;
+      cache_x0 = b0;
+      cache_x1 = b1;
+    } else {
+      if (b0 < cache_x0) {
+        blocks[i](row, by, b0, cache_x0);
+        cache_x0 = b0;
+      }
+      if (b1 > cache_x1) {
+        blocks[i](row, by, cache_x1, b1);
+        cache_x1 = b1;
+      }
+    }
+    for (int32_t x = x0; x < x1; ++x) {
+      dst[x] = row[x >> sx];
+    }
+  }
+
+  const span_t &span;
+  const framebuffer_t &fb;
+  const std::array<span_t, 3> blocks;
+  // the blocks [cache_x0, cache_x1) of block row cache_y held in scratch
+  mutable shading_rate_t cache_rate;
+  mutable int32_t cache_y, cache_x0, cache_x1;
+};
+
+// shade the pixels with x + y + checker even and leave the others, which
+// were shaded last frame
+template <typename span_t>
+struct span_checker_t {
+
+  span_checker_t(const span_t &span, const framebuffer_t &fb)
+    : half{{stride(span, 2.f, 0.f), stride(span, 2.f, 1.f)}}
+    , checker(fb.checker)
+  {
+  }
+
+  void operator()(uint32_t *dst, int32_t y, int32_t x0, int32_t x1) const {
+    // shaded pixels are at x = i * 2 + odd
+    const int32_t odd = (y + int32_t(checker)) & 1;
+    const int32_t i0 = (x0 - odd + 1) >> 1, i1 = (x1 - odd + 1) >> 1;
+    if (i0 >= i1) {
+      return;
+    }
+    uint32_t *row = scratch<uint32_t, 3>(i1);
+    half[odd](row, y, i0, i1);
+    for (int32_t i = i0; i < i1; ++i) {
+      dst[i * 2 + odd] = row[i];
+    }
+  }
+
+  const std::array<span_t, 2> half;
+  uint32_t checker;
+};
+
+// true if a span writer reads the destination pixels
+template <typename span_t>
+struct reads_dst_t {
+  static const bool value = false;
+};
+
+template <blend_mode_t BLEND, typename span_t>
+struct reads_dst_t<span_blend_t<BLEND, span_t>> {
+  static const bool value = true;
+};
+
+// hidden pixels must keep their old value
+template <typename span_t>
+struct reads_dst_t<span_depth_t<span_t>> {
+  static const bool value = true;
+};
+
+// as must the half of the checkerboard not shaded
+template <typename span_t>
+struct reads_dst_t<span_checker_t<span_t>> {
+  static const bool value = true;
+};
+
+// store a shaded span into a framebuffer row. anything other than 32bit is
+// shaded into a row buffer and converted in one go.
+template <pixel_format_t FORMAT, typename span_t>
+struct store_t {
+
+  static void span(const framebuffer_t &fb, uint8_t *row, int32_t y,
+                   int32_t x0, int32_t x1, const span_t &span) {
+    if (FORMAT == PIXEL_RGBA8) {
+      span((uint32_t *)row, y, x0, x1);
+      return;
+    }
+    if (x0 >= x1) {
+      return;
+    }
+    uint32_t *tmp = scratch<uint32_t, 0>(x1);
+    uint8_t *dst = row + x0 * pixel_size(FORMAT);
+    if (reads_dst_t<span_t>::value) {
+      fb.unpack(tmp + x0, dst, x1 - x0);
+    }
+    span(tmp, y, x0, x1);
+    if (FORMAT == PIXEL_RGB565) {
+      pack_rgb565((uint16_t *)dst, tmp + x0, x1 - x0);
+    } else {
+      fb.pack(dst, tmp + x0, x1 - x0);
+    }
+  }
+};
 
-  // sort vertices: top (0), mid (1), bottom (2)
-  if (v[1].y < v[0].y)
+// flat spans are converted once and filled in the target format
+template <pixel_format_t FORMAT>
+struct store_t<FORMAT, span_flat_t> {
+
+  static void span(const framebuffer_t &fb, uint8_t *row, int32_t y,
+                   int32_t x0, int32_t x1, const span_flat_t &span) {
+    if (x0 >= x1) {
+      return;
+    }
+    const uint32_t c = fb.pack(span.rgb);
+    switch (FORMAT) {
+    case PIXEL_RGBA8:
+      std::fill((uint32_t *)row + x0, (uint32_t *)row + x1, c);
+      break;
+    case PIXEL_RGB565:
+      std::fill((uint16_t *)row + x0, (uint16_t *)row + x1, uint16_t(c));
+      break;
+    case PIXEL_INDEX8:
+      memset(row + x0, int(c), x1 - x0);
+      break;
+    }
+  }
+};
+
+// scan convert the edges of a triangle into the covered x range [lo, hi) of
+// each row, returning false if nothing is covered. with its vertex indices
+// inside an edge_scope_t, edges are shared with the scope's other triangles.
+bool scan_edges(std::array<vec2f_t, 3> v,
+                const std::array<uint32_t, 3> *index,
+                const raster_bounds_t &bounds, int32_t *lo, int32_t *hi,
+                int32_t &y0, int32_t &y1) {
+
+  edge_cache_t &cache = edge_cache;
+  const bool indexed = index && cache.active;
+  std::array<uint32_t, 3> id = indexed ? *index : std::array<uint32_t, 3>{};
+
+  // sort vertices: top (0), mid (1), bottom (2). each edge is then set up
+  // from top to bottom whichever way the triangle is wound, so triangles
+  // either side of it can share the setup.
+  if (v[1].y < v[0].y) {
     std::swap(v[1], v[0]);
-  if (v[2].y < v[0].y)
+    std::swap(id[1], id[0]);
+  }
+  if (v[2].y < v[0].y) {
     std::swap(v[2], v[0]);
-  if (v[2].y < v[1].y)
+    std::swap(id[2], id[0]);
+  }
+  if (v[2].y < v[1].y) {
     std::swap(v[2], v[1]);
+    std::swap(id[2], id[1]);
+  }
 
   // check mid vertex side
   const float nx = v[2].y - v[0].y;
@@ -185,42 +801,467 @@ bool scan_triangle(SDL_Surface *surf, std::array<vec2f_t, 3> v, uint32_t rgb) {
     return false;
   }
 
-  // our y axis span buffers
-  std::array<int32_t, 512> lo, hi;
+  // set up edges, reusing any shared with another triangle of the batch
+  edge_setup_t e02, e01, e12;
+  if (indexed) {
+    cache.get(id[0], id[2], v[0], v[2], bounds.max_y, e02);
+    cache.get(id[0], id[1], v[0], v[1], bounds.max_y, e01);
+    cache.get(id[1], id[2], v[1], v[2], bounds.max_y, e12);
+  } else {
+    setup_edge(v[0], v[2], bounds.max_y, e02);
+    setup_edge(v[0], v[1], bounds.max_y, e01);
+    setup_edge(v[1], v[2], bounds.max_y, e12);
+  }
 
   // scan convert edges
+  const int32_t mx = bounds.max_x;
   if (d1 > d2) {
-    scan_convert<CLIP_SPAN_MIN_X>(v[0], v[2], hi);
-    scan_convert<CLIP_SPAN_MAX_X>(v[0], v[1], lo);
-    scan_convert<CLIP_SPAN_MAX_X>(v[1], v[2], lo);
+    scan_convert<CLIP_SPAN_MIN_X>(e02, hi, mx);
+    scan_convert<CLIP_SPAN_MAX_X>(e01, lo, mx);
+    scan_convert<CLIP_SPAN_MAX_X>(e12, lo, mx);
   } else {
-    scan_convert<CLIP_SPAN_MAX_X>(v[0], v[2], lo);
-    scan_convert<CLIP_SPAN_MIN_X>(v[0], v[1], hi);
-    scan_convert<CLIP_SPAN_MIN_X>(v[1], v[2], hi);
+    scan_convert<CLIP_SPAN_MAX_X>(e02, lo, mx);
+    scan_convert<CLIP_SPAN_MIN_X>(e01, hi, mx);
+    scan_convert<CLIP_SPAN_MIN_X>(e12, hi, mx);
   }
 
-  // fill triangle
-  {
-    const int32_t y0 = std::max(int32_t(ceilf(v[0].y)), 0);
-    const int32_t y1 = std::min(int32_t(v[2].y), 511);
+  y0 = std::max(int32_t(ceilf(v[0].y)), 0);
+  y1 = std::min(int32_t(v[2].y), bounds.max_y);
+  return y0 <= y1;
+}
+
+// scan convert the edges of a convex polygon into the covered x range
+// [lo, hi) of each row. edges running down the screen bound one side and
+// those running up the other, so each is converted once straight into its
+// side without triangulating.
+bool scan_chains(const vec2f_t *v, uint32_t n, const raster_bounds_t &bounds,
+                 int32_t *lo, int32_t *hi, int32_t &y0, int32_t &y1) {
+
+  // twice the signed area gives the winding, positive with the down edges
+  // on the right
+  float area = 0.f;
+  float top = v[0].y, bottom = v[0].y;
+  for (uint32_t i = 0; i < n; ++i) {
+    const vec2f_t &a = v[i], &b = v[(i + 1) % n];
+    area += a.x * b.y - b.x * a.y;
+    top = std::min(top, a.y);
+    bottom = std::max(bottom, a.y);
+  }
+  if (area == 0.f) {
+    return false;
+  }
 
-    uint32_t *py = (uint32_t *)surf->pixels;
-    py += (y0 * surf->pitch) / 4;
+  edge_setup_t e;
+  for (uint32_t i = 0; i < n; ++i) {
+    const vec2f_t &a = v[i], &b = v[(i + 1) % n];
+    if (a.y == b.y) {
+      continue;
+    }
+    const bool down = a.y < b.y;
+    setup_edge(down ? a : b, down ? b : a, bounds.max_y, e);
+    if (down == (area > 0.f)) {
+      scan_convert<CLIP_SPAN_MIN_X>(e, hi, bounds.max_x);
+    } else {
+      scan_convert<CLIP_SPAN_MAX_X>(e, lo, bounds.max_x);
+    }
+  }
+
+  y0 = std::max(int32_t(ceilf(top)), 0);
+  y1 = std::min(int32_t(bottom), bounds.max_y);
+  return y0 <= y1;
+}
+
+// scan convert a triangle or convex polygon, handing each scanline to a
+// span writer
+template <pixel_format_t FORMAT, typename span_t>
+bool scan_polygon(framebuffer_t *fb, const vec2f_t *v, uint32_t n,
+                  const std::array<uint32_t, 3> *index, const span_t &span) {
+
+  // our y axis span buffers
+  int32_t *lo = scratch<int32_t, 0>(fb->height);
+  int32_t *hi = scratch<int32_t, 1>(fb->height);
+  const raster_bounds_t bounds = {int32_t(fb->width) - 1,
+                                  int32_t(fb->height) - 1};
+  int32_t y0, y1;
+  const bool covered =
+      (n == 3)
+          ? scan_edges({v[0], v[1], v[2]}, index, bounds, lo, hi, y0, y1)
+          : scan_chains(v, n, bounds, lo, hi, y0, y1);
+  if (!covered) {
+    return false;
+  }
+  const rect_t &sc = fb->scissor;
+  y0 = std::max(y0, sc.y0);
+  y1 = std::min(y1, sc.y1 - 1);
+  if (y0 > y1) {
+    return false;
+  }
+
+  // track the screen area this polygon may touch
+  float x0 = v[0].x, x1 = v[0].x;
+  for (uint32_t i = 1; i < n; ++i) {
+    x0 = std::min(x0, v[i].x);
+    x1 = std::max(x1, v[i].x);
+  }
+  fb->dirty.mark(std::max(int32_t(floorf(x0)), sc.x0), y0,
+                 std::min(int32_t(ceilf(x1)) + 1, sc.x1), y1 + 1);
+
+  // fill polygon
+  if (fb->layout == LAYOUT_TILED) {
+    // each tile's part of a span is stored separately
     for (int32_t y = y0; y <= y1; ++y) {
-      // step to edge
-      uint32_t *px = py + lo[y];
-      // raster scanline
-      for (int32_t x = lo[y]; x < hi[y]; ++x, ++px) {
-        *px = rgb;
+      const int32_t l = std::max(lo[y], sc.x0), r = std::min(hi[y], sc.x1);
+      fb->segments(y, l, r, [&](uint8_t *row, int32_t s0, int32_t s1) {
+        store_t<FORMAT, span_t>::span(*fb, row, y, s0, s1, span);
+      });
+    }
+    return true;
+  }
+  uint8_t *py = fb->row(y0);
+  for (int32_t y = y0; y <= y1; ++y) {
+    // raster scanline
+    const int32_t l = std::max(lo[y], sc.x0), r = std::min(hi[y], sc.x1);
+    if (l < r) {
+      store_t<FORMAT, span_t>::span(*fb, py, y, l, r, span);
+    }
+    // step scanline
+    py += fb->pitch;
+  }
+
+  return true;
+}
+
+// scan convert a triangle into a multisample target. coverage is tested per
+// sample while the span writer shades each touched pixel only once.
+template <typename span_t>
+bool scan_triangle(msaa_target_t *target, const std::array<vec2f_t, 3> &v,
+                   const span_t &span) {
+
+  const float area = (v[1].x - v[0].x) * (v[2].y - v[0].y) -
+                     (v[2].x - v[0].x) * (v[1].y - v[0].y);
+  if (area == 0.f) {
+    return false;
+  }
+
+  // edge functions as e(x) = a * x + b(y), positive inside
+  struct edge_t {
+    float a, by, bc;
+  } edge[3];
+  for (int i = 0; i < 3; ++i) {
+    const vec2f_t &p = v[i], &q = v[i == 2 ? 0 : i + 1];
+    const float s = area > 0.f ? 1.f : -1.f;
+    edge[i].a = -(q.y - p.y) * s;
+    edge[i].by = (q.x - p.x) * s;
+    edge[i].bc = ((q.y - p.y) * p.x - (q.x - p.x) * p.y) * s;
+  }
+
+  const int32_t w = int32_t(target->width());
+  const int32_t h = int32_t(target->height());
+  const uint32_t ns = target->samples();
+  const uint32_t full = (1u << ns) - 1;
+  const float *ox = target->offset_x();
+  const float *oy = target->offset_y();
+
+  const float ymin = std::min(v[0].y, std::min(v[1].y, v[2].y));
+  const float ymax = std::max(v[0].y, std::max(v[1].y, v[2].y));
+  const int32_t y0 = std::max(int32_t(floorf(ymin)), 0);
+  const int32_t y1 = std::min(int32_t(ceilf(ymax)), h - 1);
+
+  // shaded colours for the current row
+  uint32_t *row = scratch<uint32_t, 2>(w);
+
+  for (int32_t y = y0; y <= y1; ++y) {
+
+    // covered pixel range for each sample on this row
+    int32_t xl[8], xr[8];
+    int32_t any_l = w, any_r = -1, all_l = 0, all_r = w - 1;
+    for (uint32_t s = 0; s < ns; ++s) {
+      // rows are sampled at integer y, as single sampled triangles are
+      const float sy = float(y) + oy[s];
+      float lo = -1e9f, hi = 1e9f;
+      for (const edge_t &e : edge) {
+        const float b = e.by * sy + e.bc;
+        if (e.a > 0.f) {
+          lo = std::max(lo, -b / e.a);
+        } else if (e.a < 0.f) {
+          hi = std::min(hi, -b / e.a);
+        } else if (b < 0.f) {
+          hi = lo - 1.f;
+        }
+      }
+      // the span [lo, hi) shifted by the sample offset is truncated to
+      // pixels as single sampled spans are
+      xl[s] = std::max(int32_t(floorf(lo - ox[s])), 0);
+      xr[s] = std::min(int32_t(floorf(hi - ox[s])) - 1, w - 1);
+      if (lo > hi) {
+        xl[s] = w;
+        xr[s] = -1;
       }
-      // step scanline
-      py += surf->pitch / 4;
+      any_l = std::min(any_l, xl[s]);
+      any_r = std::max(any_r, xr[s]);
+      all_l = std::max(all_l, xl[s]);
+      all_r = std::min(all_r, xr[s]);
+    }
+    if (any_l > any_r) {
+      continue;
+    }
+
+    // shade once per pixel
+    span(row, y, any_l, any_r + 1);
+
+    for (int32_t x = any_l; x <= any_r; ++x) {
+      uint32_t mask = full;
+      if (x < all_l || x > all_r) {
+        mask = 0;
+        for (uint32_t s = 0; s < ns; ++s) {
+          mask |= (x >= xl[s] && x <= xr[s]) ? (1u << s) : 0u;
+        }
+        if (!mask) {
+          continue;
+        }
+      }
+      target->write(uint32_t(x), uint32_t(y), row[x], mask);
     }
   }
 
   return true;
 }
 
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+
+// every render state combination gets its own kernel, with the shading
+// rate, depth test, blend mode, attributes, texture filter and pixel format
+// all fixed at compile time so the inner loops carry no state branches. the
+// flat opaque kernels compile down to the plain fill they always were.
+
+enum kernel_rate_t {
+  RATE_STAGE_FULL,
+  RATE_STAGE_COARSE,
+  RATE_STAGE_CHECKER,
+  RATE_STAGE_COUNT
+};
+
+enum depth_test_t { DEPTH_NONE, DEPTH_TEST, DEPTH_COUNT };
+
+enum kernel_attr_t {
+  ATTR_FLAT,
+  ATTR_GOURAUD,
+  ATTR_TEX_NEAREST,
+  ATTR_TEX_BILINEAR,
+  ATTR_COUNT
+};
+
+static const uint32_t BLEND_COUNT = 3;
+static const uint32_t PIXEL_COUNT = 3;
+
+// everything a kernel may need to know about one triangle or polygon
+struct tri_setup_t {
+  std::array<vec2f_t, 3> tri;
+  // the outline filled, tri itself unless drawing a polygon
+  const vec2f_t *verts;
+  uint32_t num_verts;
+  // vertex indices of a triangle, to share edge setup within an
+  // edge_scope_t, or null
+  const std::array<uint32_t, 3> *index;
+  // 1/w, for depth testing and perspective correction
+  gradient_t q;
+  // flat colour
+  uint32_t rgb;
+  // gouraud colour planes
+  gradient_t r, g, b;
+  // u/w and v/w in base level texels
+  const texture_t *tex;
+  gradient_t u, v;
+  uint32_t opacity;
+};
+
+// the span writer for a set of attributes
+template <kernel_attr_t ATTR>
+struct attr_stage_t;
+
+template <>
+struct attr_stage_t<ATTR_FLAT> {
+  typedef span_flat_t type;
+  static type make(const tri_setup_t &s) {
+    return type{s.rgb};
+  }
+};
+
+template <>
+struct attr_stage_t<ATTR_GOURAUD> {
+  typedef span_gouraud_t type;
+  static type make(const tri_setup_t &s) {
+    return type{s.r, s.g, s.b};
+  }
+};
+
+template <>
+struct attr_stage_t<ATTR_TEX_NEAREST> {
+  typedef span_tex_t<TEX_FILTER_NEAREST> type;
+  static type make(const tri_setup_t &s) {
+    return type{*s.tex, s.u, s.v, s.q};
+  }
+};
+
+template <>
+struct attr_stage_t<ATTR_TEX_BILINEAR> {
+  typedef span_tex_t<TEX_FILTER_BILINEAR> type;
+  static type make(const tri_setup_t &s) {
+    return type{*s.tex, s.u, s.v, s.q};
+  }
+};
+
+// optionally wrap a span writer in a reduced shading rate, flat spans have
+// nothing to save so are always written in full
+template <kernel_rate_t RATE, typename span_t>
+struct rate_stage_t {
+  typedef span_t type;
+  static const span_t &make(const span_t &span, const framebuffer_t *) {
+    return span;
+  }
+};
+
+template <typename span_t>
+struct rate_stage_t<RATE_STAGE_COARSE, span_t> {
+  typedef span_coarse_t<span_t> type;
+  static type make(const span_t &span, const framebuffer_t *fb) {
+    return type{span, *fb};
+  }
+};
+
+template <typename span_t>
+struct rate_stage_t<RATE_STAGE_CHECKER, span_t> {
+  typedef span_checker_t<span_t> type;
+  static type make(const span_t &span, const framebuffer_t *fb) {
+    return type{span, *fb};
+  }
+};
+
+template <>
+struct rate_stage_t<RATE_STAGE_COARSE, span_flat_t>
+  : rate_stage_t<RATE_STAGE_FULL, span_flat_t> {};
+
+template <>
+struct rate_stage_t<RATE_STAGE_CHECKER, span_flat_t>
+  : rate_stage_t<RATE_STAGE_FULL, span_flat_t> {};
+
+// optionally wrap a span writer in a blend stage
+template <blend_mode_t BLEND, typename span_t>
+struct blend_stage_t {
+  typedef span_blend_t<BLEND, span_t> type;
+  static type make(const span_t &span, const tri_setup_t &s) {
+    return type{span, s.opacity};
+  }
+};
+
+template <typename span_t>
+struct blend_stage_t<BLEND_NONE, span_t> {
+  typedef span_t type;
+  static const span_t &make(const span_t &span, const tri_setup_t &) {
+    return span;
+  }
+};
+
+// optionally wrap a span writer in a depth test
+template <depth_test_t DEPTH, typename span_t>
+struct depth_stage_t {
+  typedef span_depth_t<span_t> type;
+  static type make(const span_t &span, framebuffer_t *fb,
+                   const tri_setup_t &s) {
+    return type{span, *fb, s.q};
+  }
+};
+
+template <typename span_t>
+struct depth_stage_t<DEPTH_NONE, span_t> {
+  typedef span_t type;
+  static const span_t &make(const span_t &span, framebuffer_t *,
+                            const tri_setup_t &) {
+    return span;
+  }
+};
+
+template <kernel_rate_t RATE, depth_test_t DEPTH, blend_mode_t BLEND,
+          kernel_attr_t ATTR, pixel_format_t FORMAT>
+void raster_kernel(framebuffer_t *fb, const tri_setup_t &s) {
+  typedef attr_stage_t<ATTR> attr_stage;
+  typedef rate_stage_t<RATE, typename attr_stage::type> rate_stage;
+  typedef blend_stage_t<BLEND, typename rate_stage::type> blend_stage;
+  typedef depth_stage_t<DEPTH, typename blend_stage::type> depth_stage;
+  const typename attr_stage::type shade = attr_stage::make(s);
+  const typename rate_stage::type &rated = rate_stage::make(shade, fb);
+  const typename blend_stage::type &blend = blend_stage::make(rated, s);
+  const typename depth_stage::type &depth = depth_stage::make(blend, fb, s);
+  scan_polygon<FORMAT>(fb, s.verts, s.num_verts, s.index, depth);
+}
+
+typedef void (*kernel_t)(framebuffer_t *, const tri_setup_t &);
+
+constexpr uint32_t kernel_index(uint32_t rate, uint32_t depth,
+                                uint32_t blend, uint32_t attr,
+                                uint32_t format) {
+  return (((rate * DEPTH_COUNT + depth) * BLEND_COUNT + blend) * ATTR_COUNT +
+          attr) *
+             PIXEL_COUNT +
+         format;
+}
+
+template <uint32_t I>
+constexpr kernel_t kernel_at() {
+  return &raster_kernel<
+      kernel_rate_t(I / (PIXEL_COUNT * ATTR_COUNT * BLEND_COUNT *
+                         DEPTH_COUNT)),
+      depth_test_t(I / (PIXEL_COUNT * ATTR_COUNT * BLEND_COUNT) %
+                   DEPTH_COUNT),
+      blend_mode_t(I / (PIXEL_COUNT * ATTR_COUNT) % BLEND_COUNT),
+      kernel_attr_t(I / PIXEL_COUNT % ATTR_COUNT),
+      pixel_format_t(I % PIXEL_COUNT)>;
+}
+
+template <uint32_t... I>
+constexpr std::array<kernel_t, sizeof...(I)>
+make_kernels(std::integer_sequence<uint32_t, I...>) {
+  return {{kernel_at<I>()...}};
+}
+
+// every kernel, indexed by kernel_index
+const uint32_t KERNEL_COUNT = RATE_STAGE_COUNT * DEPTH_COUNT * BLEND_COUNT *
+                              ATTR_COUNT * PIXEL_COUNT;
+const std::array<kernel_t, KERNEL_COUNT> kernels =
+    make_kernels(std::make_integer_sequence<uint32_t, KERNEL_COUNT>());
+
+// pick the kernel for the current state, once per triangle
+void dispatch(framebuffer_t *fb, kernel_attr_t attr, blend_mode_t blend,
+              const tri_setup_t &s) {
+  // a blended pixel cannot be left for the next frame to fill in
+  uint32_t rate = RATE_STAGE_FULL;
+  if (fb->rate == RATE_CHECKER && blend == BLEND_NONE) {
+    rate = RATE_STAGE_CHECKER;
+  } else if (fb->rate >= RATE_2X1 || !fb->rate_map.empty()) {
+    rate = RATE_STAGE_COARSE;
+  }
+  const uint32_t depth = fb->depth.empty() ? DEPTH_NONE : DEPTH_TEST;
+  kernels[kernel_index(rate, depth, blend, attr, fb->format)](fb, s);
+}
+
+// the screen space triangle, false if it is back facing
+bool setup_tri(const std::array<math::vec4f_t, 3> &t, tri_setup_t &s) {
+  s.tri = {
+      vec2f_t{t[0].x, t[0].y},
+      vec2f_t{t[1].x, t[1].y},
+      vec2f_t{t[2].x, t[2].y},
+  };
+  s.verts = s.tri.data();
+  s.num_verts = 3;
+  s.index = nullptr;
+  return !is_backface(s.tri[0], s.tri[2], s.tri[1]);
+}
+
+// the 1/w plane is only solved for when something uses it
+void setup_depth(const std::array<math::vec4f_t, 3> &t, tri_setup_t &s) {
+  s.q = gradient_t{s.tri, 1.f / t[0].w, 1.f / t[1].w, 1.f / t[2].w};
+}
+
 bool clip_line(vec2f_t &a, vec2f_t &b) {
 
   enum {
@@ -312,7 +1353,7 @@ bool clip_line(vec2f_t &a, vec2f_t &b) {
 }
 
 // fast fixed point line drawing
-void draw_line(SDL_Surface *surf, math::vec2f_t a, math::vec2f_t b,
+void draw_line(framebuffer_t *fb, math::vec2f_t a, math::vec2f_t b,
                uint32_t rgb) {
   // clip line to screen
   if (clip_line(a, b)) {
@@ -348,7 +1389,7 @@ void draw_line(SDL_Surface *surf, math::vec2f_t a, math::vec2f_t b,
     const int32_t ibx = int32_t(b.x);
     // raster loop
     for (int32_t x = iax; x < ibx; ++x, y += iy) {
-      plot(surf, x, y >> 16, rgb);
+      plot(fb, x, y >> 16, rgb);
     }
   } else {
     // sort vertices in y axis
@@ -371,31 +1412,498 @@ void draw_line(SDL_Surface *surf, math::vec2f_t a, math::vec2f_t b,
     const int32_t iby = int32_t(b.y);
     // raster loop
     for (int32_t y = iay; y < iby; ++y, x += ix) {
-      plot(surf, x >> 16, y, rgb);
+      plot(fb, x >> 16, y, rgb);
     }
   }
 }
 
 // draw a wireframe triangle
-void draw_tri(SDL_Surface *surf, const std::array<math::vec4f_t, 3> &t,
-              uint32_t rgb) {
-
-  const std::array<vec2f_t, 3> tri = {
-      vec2f_t{t[0].x, t[0].y},
-      vec2f_t{t[1].x, t[1].y},
-      vec2f_t{t[2].x, t[2].y},
-  };
+void draw_tri(framebuffer_t *fb, const std::array<math::vec4f_t, 3> &t,
+              uint32_t rgb, const blend_t &blend,
+              const std::array<uint32_t, 3> *index) {
 
-  if (!is_backface(tri[0], tri[2], tri[1])) {
+  tri_setup_t s;
+  if (setup_tri(t, s)) {
+    s.index = index;
 #if 1
-    scan_triangle(surf, tri, rgb);
+    if (!fb->depth.empty()) {
+      setup_depth(t, s);
+    }
+    s.rgb = rgb;
+    s.opacity = blend.opacity;
+    dispatch(fb, ATTR_FLAT, blend.mode, s);
 #endif
 #if 0
     for (uint32_t j = 0; j < 3; ++j) {
       const math::vec4f_t &a = t[j];
       const math::vec4f_t &b = t[j == 2 ? 0 : j + 1];
-      draw_line(surf, math::vec2(a.x, a.y), math::vec2(b.x, b.y), 0xffffff);
+      draw_line(fb, math::vec2(a.x, a.y), math::vec2(b.x, b.y), 0xffffff);
     }
 #endif
   }
 }
+
+// draw a flat shaded triangle into a multisample target, blending into a
+// multisample target is not supported so it is always drawn opaque
+void draw_tri(msaa_target_t *target, const std::array<math::vec4f_t, 3> &t,
+              uint32_t rgb, const blend_t &,
+              const std::array<uint32_t, 3> *) {
+
+  tri_setup_t s;
+  if (setup_tri(t, s)) {
+    scan_triangle(target, s.tri, span_flat_t{rgb});
+  }
+}
+
+// screen space u/w, v/w and 1/w planes of a textured triangle
+void tex_gradients(const std::array<vec2f_t, 3> &tri,
+                   const std::array<math::vec4f_t, 3> &t,
+                   const std::array<math::vec2f_t, 3> &uv,
+                   const texture_t &tex, gradient_t &gu, gradient_t &gv,
+                   gradient_t &gq) {
+  const float size = float(tex.size());
+  const float q0 = 1.f / t[0].w, q1 = 1.f / t[1].w, q2 = 1.f / t[2].w;
+  gu = gradient_t{tri, uv[0].x * size * q0, uv[1].x * size * q1,
+                  uv[2].x * size * q2};
+  gv = gradient_t{tri, uv[0].y * size * q0, uv[1].y * size * q1,
+                  uv[2].y * size * q2};
+  gq = gradient_t{tri, q0, q1, q2};
+}
+
+// draw a perspective correct texture mapped triangle
+void draw_tri_tex(framebuffer_t *fb, const std::array<math::vec4f_t, 3> &t,
+                  const std::array<math::vec2f_t, 3> &uv,
+                  const texture_t &tex, tex_filter_t filter,
+                  const blend_t &blend,
+                  const std::array<uint32_t, 3> *index) {
+
+  tri_setup_t s;
+  if (!setup_tri(t, s) || tex.levels() == 0) {
+    return;
+  }
+  s.index = index;
+
+  // interpolate u/w, v/w and 1/w linearly in screen space
+  tex_gradients(s.tri, t, uv, tex, s.u, s.v, s.q);
+  s.tex = &tex;
+  s.opacity = blend.opacity;
+  dispatch(fb,
+           (filter == TEX_FILTER_NEAREST) ? ATTR_TEX_NEAREST
+                                          : ATTR_TEX_BILINEAR,
+           blend.mode, s);
+}
+
+void draw_tri_tex(msaa_target_t *target,
+                  const std::array<math::vec4f_t, 3> &t,
+                  const std::array<math::vec2f_t, 3> &uv,
+                  const texture_t &tex, tex_filter_t filter,
+                  const blend_t &, const std::array<uint32_t, 3> *) {
+
+  tri_setup_t s;
+  if (!setup_tri(t, s) || tex.levels() == 0) {
+    return;
+  }
+
+  tex_gradients(s.tri, t, uv, tex, s.u, s.v, s.q);
+  s.tex = &tex;
+  switch (filter) {
+  case TEX_FILTER_NEAREST:
+    scan_triangle(target, s.tri, attr_stage_t<ATTR_TEX_NEAREST>::make(s));
+    break;
+  case TEX_FILTER_BILINEAR:
+    scan_triangle(target, s.tri, attr_stage_t<ATTR_TEX_BILINEAR>::make(s));
+    break;
+  }
+}
+
+// colour planes of a triangle from packed 0xRRGGBB vertex colours
+span_gouraud_t gouraud_span(const std::array<vec2f_t, 3> &tri,
+                            const std::array<uint32_t, 3> &rgb) {
+  const auto channel = [&](uint32_t shift) {
+    return gradient_t{tri, float((rgb[0] >> shift) & 0xff),
+                      float((rgb[1] >> shift) & 0xff),
+                      float((rgb[2] >> shift) & 0xff)};
+  };
+  return span_gouraud_t{channel(16), channel(8), channel(0)};
+}
+
+// draw a gouraud shaded triangle from packed 0xRRGGBB vertex colours
+void draw_tri_gouraud(framebuffer_t *fb, const std::array<math::vec4f_t, 3> &t,
+                      const std::array<uint32_t, 3> &rgb,
+                      const blend_t &blend,
+                      const std::array<uint32_t, 3> *index) {
+
+  tri_setup_t s;
+  if (!setup_tri(t, s)) {
+    return;
+  }
+  s.index = index;
+
+  const span_gouraud_t span = gouraud_span(s.tri, rgb);
+  s.r = span.r;
+  s.g = span.g;
+  s.b = span.b;
+  if (!fb->depth.empty()) {
+    setup_depth(t, s);
+  }
+  s.opacity = blend.opacity;
+  dispatch(fb, ATTR_GOURAUD, blend.mode, s);
+}
+
+void draw_tri_gouraud(msaa_target_t *target,
+                      const std::array<math::vec4f_t, 3> &t,
+                      const std::array<uint32_t, 3> &rgb,
+                      const blend_t &, const std::array<uint32_t, 3> *) {
+
+  tri_setup_t s;
+  if (setup_tri(t, s)) {
+    scan_triangle(target, s.tri, gouraud_span(s.tri, rgb));
+  }
+}
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+
+// the screen space outline of a convex polygon, false if it is back facing
+// or degenerate. attribute planes are fitted over every vertex so a
+// polygon is filled in a single pass rather than as a fan of triangles.
+// that only holds when every attribute is planar, which is left in planar.
+struct poly_setup_t : tri_setup_t {
+  std::array<vec2f_t, max_poly_verts> outline;
+  std::array<float, max_poly_verts> q0;
+  bool planar;
+
+  bool setup(const math::vec4f_t *t, uint32_t n) {
+    if (n < 3 || n > max_poly_verts) {
+      return false;
+    }
+    float area = 0.f;
+    for (uint32_t i = 0; i < n; ++i) {
+      const math::vec4f_t &a = t[i], &b = t[(i + 1) % n];
+      area += a.x * b.y - b.x * a.y;
+      outline[i] = vec2f_t{a.x, a.y};
+      q0[i] = 1.f / a.w;
+    }
+    tri = {outline[0], outline[1], outline[2]};
+    verts = outline.data();
+    num_verts = n;
+    index = nullptr;
+    planar = true;
+    return area > 0.f;
+  }
+
+  gradient_t plane(const float *a) {
+    const gradient_t g{verts, a, num_verts};
+    planar = planar && g.fits(verts, a, num_verts);
+    return g;
+  }
+
+  void setup_depth() {
+    q = plane(q0.data());
+  }
+
+  // one colour channel from packed 0xRRGGBB vertex colours
+  gradient_t channel(const uint32_t *rgb, uint32_t shift) {
+    std::array<float, max_poly_verts> a;
+    for (uint32_t i = 0; i < num_verts; ++i) {
+      a[i] = float((rgb[i] >> shift) & 0xff);
+    }
+    return plane(a.data());
+  }
+};
+
+// the vertex indices of triangle i of a polygon's fan, or null without any
+const std::array<uint32_t, 3> *fan_index(const uint32_t *index, uint32_t i,
+                                         std::array<uint32_t, 3> &tri) {
+  if (!index) {
+    return nullptr;
+  }
+  tri = {index[0], index[i - 1], index[i]};
+  return &tri;
+}
+
+// draw a flat shaded convex polygon
+void draw_poly(framebuffer_t *fb, const math::vec4f_t *t, uint32_t n,
+               uint32_t rgb, const blend_t &blend, const uint32_t *index) {
+
+  poly_setup_t s;
+  if (!s.setup(t, n)) {
+    return;
+  }
+  if (!fb->depth.empty()) {
+    s.setup_depth();
+  }
+  if (!s.planar) {
+    std::array<uint32_t, 3> tri;
+    for (uint32_t i = 2; i < n; ++i) {
+      draw_tri(fb, {t[0], t[i - 1], t[i]}, rgb, blend,
+               fan_index(index, i, tri));
+    }
+    return;
+  }
+  s.rgb = rgb;
+  s.opacity = blend.opacity;
+  dispatch(fb, ATTR_FLAT, blend.mode, s);
+}
+
+// draw a perspective correct texture mapped convex polygon
+void draw_poly_tex(framebuffer_t *fb, const math::vec4f_t *t, uint32_t n,
+                   const math::vec2f_t *uv, const texture_t &tex,
+                   tex_filter_t filter, const blend_t &blend,
+                   const uint32_t *index) {
+
+  poly_setup_t s;
+  if (!s.setup(t, n) || tex.levels() == 0) {
+    return;
+  }
+
+  const float size = float(tex.size());
+  std::array<float, max_poly_verts> u, v;
+  for (uint32_t i = 0; i < n; ++i) {
+    u[i] = uv[i].x * size * s.q0[i];
+    v[i] = uv[i].y * size * s.q0[i];
+  }
+  s.u = s.plane(u.data());
+  s.v = s.plane(v.data());
+  s.setup_depth();
+  if (!s.planar) {
+    std::array<uint32_t, 3> tri;
+    for (uint32_t i = 2; i < n; ++i) {
+      draw_tri_tex(fb, {t[0], t[i - 1], t[i]}, {uv[0], uv[i - 1], uv[i]},
+                   tex, filter, blend, fan_index(index, i, tri));
+    }
+    return;
+  }
+  s.tex = &tex;
+  s.opacity = blend.opacity;
+  dispatch(fb,
+           (filter == TEX_FILTER_NEAREST) ? ATTR_TEX_NEAREST
+                                          : ATTR_TEX_BILINEAR,
+           blend.mode, s);
+}
+
+// draw a gouraud shaded convex polygon from packed 0xRRGGBB vertex colours
+void draw_poly_gouraud(framebuffer_t *fb, const math::vec4f_t *t,
+                       uint32_t n, const uint32_t *rgb,
+                       const blend_t &blend, const uint32_t *index) {
+
+  poly_setup_t s;
+  if (!s.setup(t, n)) {
+    return;
+  }
+  s.r = s.channel(rgb, 16);
+  s.g = s.channel(rgb, 8);
+  s.b = s.channel(rgb, 0);
+  if (!fb->depth.empty()) {
+    s.setup_depth();
+  }
+  if (!s.planar) {
+    std::array<uint32_t, 3> tri;
+    for (uint32_t i = 2; i < n; ++i) {
+      draw_tri_gouraud(fb, {t[0], t[i - 1], t[i]},
+                       {rgb[0], rgb[i - 1], rgb[i]}, blend,
+                       fan_index(index, i, tri));
+    }
+    return;
+  }
+  s.opacity = blend.opacity;
+  dispatch(fb, ATTR_GOURAUD, blend.mode, s);
+}
+
+// multisample targets take polygons as a fan of triangles
+void draw_poly(msaa_target_t *target, const math::vec4f_t *t, uint32_t n,
+               uint32_t rgb, const blend_t &blend, const uint32_t *) {
+  for (uint32_t i = 2; i < n; ++i) {
+    draw_tri(target, {t[0], t[i - 1], t[i]}, rgb, blend);
+  }
+}
+
+void draw_poly_tex(msaa_target_t *target, const math::vec4f_t *t,
+                   uint32_t n, const math::vec2f_t *uv, const texture_t &tex,
+                   tex_filter_t filter, const blend_t &blend,
+                   const uint32_t *) {
+  for (uint32_t i = 2; i < n; ++i) {
+    draw_tri_tex(target, {t[0], t[i - 1], t[i]}, {uv[0], uv[i - 1], uv[i]},
+                 tex, filter, blend);
+  }
+}
+
+void draw_poly_gouraud(msaa_target_t *target, const math::vec4f_t *t,
+                       uint32_t n, const uint32_t *rgb,
+                       const blend_t &blend, const uint32_t *) {
+  for (uint32_t i = 2; i < n; ++i) {
+    draw_tri_gouraud(target, {t[0], t[i - 1], t[i]},
+                     {rgb[0], rgb[i - 1], rgb[i]}, blend);
+  }
+}
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+
+// rasterize a triangle's id and depth into a visibility buffer, keeping the
+// nearest triangle at each pixel. no shading is done here.
+void draw_vis(visbuf_t *vb, const std::array<math::vec4f_t, 3> &t,
+              uint32_t id, const std::array<uint32_t, 3> *index) {
+
+  const std::array<vec2f_t, 3> tri = {
+      vec2f_t{t[0].x, t[0].y},
+      vec2f_t{t[1].x, t[1].y},
+      vec2f_t{t[2].x, t[2].y},
+  };
+
+  if (is_backface(tri[0], tri[2], tri[1])) {
+    return;
+  }
+
+  int32_t *lo = scratch<int32_t, 0>(vb->height());
+  int32_t *hi = scratch<int32_t, 1>(vb->height());
+  const raster_bounds_t bounds = {int32_t(vb->width()) - 1,
+                                  int32_t(vb->height()) - 1};
+  int32_t y0, y1;
+  if (!scan_edges(tri, index, bounds, lo, hi, y0, y1)) {
+    return;
+  }
+
+  // 1/w is linear in screen space
+  const gradient_t gq{tri, 1.f / t[0].w, 1.f / t[1].w, 1.f / t[2].w};
+
+  for (int32_t y = y0; y <= y1; ++y) {
+    float *depth = vb->depth_row(y);
+    uint32_t *ids = vb->id_row(y);
+    float q = gq.at(float(lo[y]), float(y));
+    for (int32_t x = lo[y]; x < hi[y]; ++x, q += gq.dx) {
+      if (q > depth[x]) {
+        depth[x] = q;
+        ids[x] = id;
+      }
+    }
+  }
+}
+
+// add a triangle to a whole scene scanline renderer
+void draw_hsr(hsr_t *hsr, const std::array<math::vec4f_t, 3> &t,
+              uint32_t id) {
+  if (is_backface(vec2f_t{t[0].x, t[0].y}, vec2f_t{t[2].x, t[2].y},
+                  vec2f_t{t[1].x, t[1].y})) {
+    return;
+  }
+  hsr->add(t, id);
+}
+
+// shade a screen of visible runs one row at a time, shading each run with
+// shade(id, row, y, x0, x1) into a line buffer. with fill the gaps are set
+// to bg and each row stored in one go, otherwise only the runs are stored.
+// the runs come from src.runs(y, out). with a scheduler, bands of rows are
+// shaded in parallel, otherwise rows are asked for in order.
+template <typename source_t, typename shade_t>
+void shade_runs(framebuffer_t *fb, source_t &src, uint32_t bg, bool fill,
+                const shade_t &shade, jobs_t *jobs) {
+  const int32_t w = int32_t(fb->width);
+  const int32_t h = int32_t(fb->height);
+
+  // line buffers come from the frame arena when there is a scheduler
+  std::vector<uint32_t> line;
+  const auto band = [=, &src, &shade, &line](uint32_t y0, uint32_t y1) {
+    uint32_t *row = jobs ? jobs->arena().alloc<uint32_t>(w) : line.data();
+    // kept between frames so steady state rows do not allocate
+    thread_local std::vector<vis_run_t> runs;
+    for (int32_t y = int32_t(y0); y < int32_t(y1); ++y) {
+      src.runs(y, runs);
+      int32_t x = 0;
+      for (const vis_run_t &r : runs) {
+        const int32_t x0 = std::max(r.x0, x), x1 = std::min(r.x1, w);
+        if (fill) {
+          std::fill(row + x, row + std::max(x0, x), bg);
+        }
+        if (x0 < x1) {
+          shade(r.id, row, y, x0, x1);
+          if (!fill) {
+            fb->store(y, x0, x1, row);
+          }
+          x = x1;
+        }
+      }
+      if (fill) {
+        std::fill(row + x, row + w, bg);
+        fb->store(y, 0, w, row);
+      }
+    }
+  };
+
+  if (jobs) {
+    jobs->wait(jobs->parallel_for(0, h, 16, band));
+  } else {
+    line.resize(w);
+    band(0, h);
+  }
+  fb->dirty.mark_all();
+}
+
+std::array<vec2f_t, 3> vis_tri(const vis_mesh_t &mesh, uint32_t id,
+                               std::array<uint32_t, 3> &index) {
+  const uint32_t *i = mesh.index + id * 3;
+  index = {i[0], i[1], i[2]};
+  const vec4f_t *s = mesh.screen;
+  return {
+      vec2f_t{s[i[0]].x, s[i[0]].y},
+      vec2f_t{s[i[1]].x, s[i[1]].y},
+      vec2f_t{s[i[2]].x, s[i[2]].y},
+  };
+}
+
+// shade a run of triangle id of one batch
+void shade_vis_run(const vis_batch_t &b, uint32_t id, uint32_t *row,
+                   int32_t y, int32_t x0, int32_t x1) {
+  if (!b.tex && !b.rgb) {
+    span_flat_t{b.tri_rgb[id]}(row, y, x0, x1);
+    return;
+  }
+  std::array<uint32_t, 3> i;
+  const std::array<vec2f_t, 3> tri = vis_tri(b.mesh, id, i);
+  if (!b.tex) {
+    const uint32_t *rgb = b.rgb;
+    gouraud_span(tri, {rgb[i[0]], rgb[i[1]], rgb[i[2]]})(row, y, x0, x1);
+    return;
+  }
+  const vec4f_t *s = b.mesh.screen;
+  const math::vec2f_t *uv = b.uv;
+  gradient_t gu, gv, gq;
+  tex_gradients(tri, {s[i[0]], s[i[1]], s[i[2]]},
+                {uv[i[0]], uv[i[1]], uv[i[2]]}, *b.tex, gu, gv, gq);
+  switch (b.filter) {
+  case TEX_FILTER_NEAREST:
+    span_tex_t<TEX_FILTER_NEAREST>{*b.tex, gu, gv, gq}(row, y, x0, x1);
+    break;
+  case TEX_FILTER_BILINEAR:
+    span_tex_t<TEX_FILTER_BILINEAR>{*b.tex, gu, gv, gq}(row, y, x0, x1);
+    break;
+  }
+}
+
+// shade visible runs, each with the batch its id falls in
+template <typename source_t>
+void vis_batches(framebuffer_t *fb, source_t &src, const vis_batch_t *batch,
+                 uint32_t num_batches, uint32_t bg, bool fill,
+                 jobs_t *jobs) {
+  shade_runs(fb, src, bg, fill, [&](uint32_t id, uint32_t *row, int32_t y,
+                                    int32_t x0, int32_t x1) {
+    const vis_batch_t *b =
+        std::upper_bound(batch, batch + num_batches, id,
+                         [](uint32_t id, const vis_batch_t &b) {
+                           return id < b.first;
+                         }) - 1;
+    shade_vis_run(*b, id - b->first, row, y, x0, x1);
+  }, jobs);
+}
+
+// shade a visibility buffer
+void shade_vis(framebuffer_t *fb, const visbuf_t &vb,
+               const vis_batch_t *batch, uint32_t num_batches, uint32_t bg,
+               bool fill, jobs_t *jobs) {
+  vis_batches(fb, vb, batch, num_batches, bg, fill, jobs);
+}
+
+// shade the visible spans of a scanline scene. its rows are produced in
+// order so they are always shaded on the calling thread.
+void shade_vis(framebuffer_t *fb, hsr_t &hsr, const vis_batch_t *batch,
+               uint32_t num_batches, uint32_t bg, bool fill, jobs_t *) {
+  vis_batches(fb, hsr, batch, num_batches, bg, fill, nullptr);
+}
@@ -0,0 +1,217 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "blend.h"
+#include "dirty.h"
+#include "framebuffer.h"
+#include "hsr.h"
+#include "jobs.h"
+#include "math.h"
+#include "mesh.h"
+#include "msaa.h"
+#include "texture.h"
+#include "visbuf.h"
+
+// public interface to the scanline renderer. geometry is submitted in
+// batches to a render context, contexts share nothing so any number of them
+// can be used side by side in one process.
+
+enum shade_mode_t { SHADE_FLAT, SHADE_GOURAUD, SHADE_TEXTURE };
+
+// how opaque geometry is resolved
+enum hidden_mode_t {
+  // painter's order, triangles shaded as they are drawn
+  HIDDEN_NONE,
+  // ids and depth first then each pixel shaded once
+  HIDDEN_VISBUF,
+  // whole scene active edge list, each row written once
+  HIDDEN_SCANLINE,
+};
+
+// how a batch's indices form triangles
+enum topology_t {
+  // three indices per triangle
+  TOPOLOGY_LIST,
+  // each index after the first two adds a triangle with the previous two
+  TOPOLOGY_STRIP,
+  // each index after the first two adds a triangle with the first and the
+  // previous one
+  TOPOLOGY_FAN,
+  // convex polygons separated by the restart index, each filled in one
+  // pass. tri_rgb gives one colour per polygon. polygons longer than
+  // max_poly_verts are split and hidden surface modes draw them as fans.
+  TOPOLOGY_POLYGON,
+};
+
+struct draw_state_t {
+  shade_mode_t shade;
+  blend_t blend;
+  // used by SHADE_TEXTURE
+  const texture_t *texture;
+  tex_filter_t filter;
+  // for forward drawn batches into a framebuffer, combined with its
+  // rate_map. a frame's first batch decides how it is cleared, so a
+  // RATE_CHECKER frame should start with a RATE_CHECKER batch. coherent
+  // frames shade checkerboard batches in full.
+  shading_rate_t rate;
+};
+
+// indexed triangles in screen space. only the attributes the draw state
+// uses need to be given.
+struct draw_batch_t {
+  // from matrix_t::project
+  const math::vec4f_t *screen;
+  const uint32_t *index;
+  uint32_t num_index;
+  // 16bit indices used in place of index when given, restarting at
+  // packed_mesh_t::restart_index16
+  const uint16_t *index16;
+  // packed 0xRRGGBB per vertex, for SHADE_GOURAUD
+  const uint32_t *rgb;
+  // per vertex, for SHADE_TEXTURE
+  const math::vec2f_t *uv;
+  // one colour per assembled triangle, for SHADE_FLAT
+  const uint32_t *tri_rgb;
+  // optional draw order for lists as offsets into index, such as from
+  // mesh_t::sort_back_to_front
+  const uint32_t *order;
+  topology_t topology;
+  // strips and fans start over at restart_index, polygons always do
+  bool restart;
+  // identifies the geometry, transform and attributes, such as a hash of
+  // the matrix and mesh version. a coherent context assumes a batch drawn
+  // with the same nonzero key and state as last frame gives the same
+  // pixels. 0 is never reused.
+  uint64_t key;
+};
+
+// one view of a batch drawn by render_context_t::draw_views
+struct view_t {
+  // the batch's vertices projected for this view, such as by the multiple
+  // view matrix_t::project
+  const math::vec4f_t *screen;
+  // a target of its own, cleared before drawing, or null or the context's
+  // framebuffer to draw into that. no two views may share a target of
+  // their own.
+  framebuffer_t *target;
+  // triangles are clipped to this part of the target
+  rect_t viewport;
+};
+
+struct render_context_t {
+
+  render_context_t();
+
+  // optional scheduler for the stages that run in parallel
+  void set_jobs(jobs_t *jobs);
+
+  // hidden surface removal for opaque batches into a framebuffer. the
+  // visibility buffer and scanline modes gather the ids of every opaque
+  // batch, then resolve and shade them together by end or by the next
+  // batch drawn some other way. those batches must stay valid until then.
+  void set_hidden(hidden_mode_t mode);
+
+  // keep frames coherent, forward drawn batches into a framebuffer are
+  // deferred to end and compared with last frame's. only the area covered
+  // by batches that changed, or by tiles of the target's rate map that
+  // did, is cleared and redrawn, so a frame where nothing changed costs
+  // nearly nothing. batches must stay valid until end.
+  void set_coherent(bool enable);
+
+  // start a frame into fb, cleared to clear_rgb. with a multisample target
+  // drawing goes there instead and is resolved into fb by end.
+  void begin(framebuffer_t *fb, uint32_t clear_rgb,
+             msaa_target_t *msaa = nullptr);
+
+  void draw(const draw_batch_t &batch, const draw_state_t &state);
+
+  // draw a batch once per view, its screen vertices taken from each view.
+  // views with their own targets are drawn in parallel with each other
+  // and with those into the context's framebuffer, which are drawn in
+  // order. views are forward drawn straight into framebuffers, so are
+  // ignored with a hidden surface mode or a multisample target, and a
+  // coherent frame is drawn in full once it has views.
+  void draw_views(const draw_batch_t &batch, const draw_state_t &state,
+                  const view_t *views, uint32_t num_views);
+
+  void end();
+
+protected:
+  // a batch waiting for end in coherent mode
+  struct deferred_t {
+    draw_batch_t batch;
+    draw_state_t state;
+    rect_t bounds;
+  };
+
+  // what was drawn last frame in coherent mode
+  struct cached_t {
+    uint64_t key;
+    draw_state_t state;
+    rect_t bounds;
+  };
+
+  // everything about the target that the cached frame depends on
+  struct target_key_t {
+    const framebuffer_t *fb;
+    uint32_t width, height;
+    pixel_format_t format;
+    fb_layout_t layout;
+    bool depth;
+    uint32_t clear;
+  };
+
+  // clear the framebuffer before the first forward drawn batch, only the
+  // half of the pixels to be shaded for a checkerboard batch
+  void clear(bool checker);
+
+  // redraw whatever changed since last frame
+  void draw_coherent();
+
+  // draw a coherent frame's batches so far as a normal frame
+  void flush_deferred();
+
+  template <typename target_t>
+  void draw_forward(target_t *target, const draw_batch_t &batch,
+                    const draw_state_t &state);
+
+  template <typename source_t>
+  void draw_hidden(source_t &src, const draw_batch_t &batch,
+                   const draw_state_t &state);
+
+  // shade the hidden surface batches gathered so far
+  void resolve_hidden();
+
+  framebuffer_t *fb_;
+  msaa_target_t *msaa_;
+  uint32_t clear_;
+  bool cleared_;
+  hidden_mode_t hidden_;
+  jobs_t *jobs_;
+  visbuf_t vis_;
+  hsr_t hsr_;
+  std::vector<rect_t> rects_;
+  // a batch waiting to be shaded by a hidden surface pass, with offsets
+  // into list_ and fan_rgb_ once expanded
+  struct hidden_t {
+    vis_batch_t batch;
+    size_t list, rgb;
+  };
+  std::vector<hidden_t> pending_;
+  std::vector<vis_batch_t> batches_;
+  // ids given to the hidden surface batches so far
+  uint32_t num_ids_;
+  // strips and fans expanded to a list for the hidden surface passes
+  std::vector<uint32_t> list_;
+  // per triangle flat colours of fanned polygons
+  std::vector<uint32_t> fan_rgb_;
+  bool coherent_;
+  // true for frames where drawing is deferred to end
+  bool deferred_;
+  std::vector<deferred_t> draws_;
+  std::vector<cached_t> cache_;
+  target_key_t target_;
+  // the target's rate map last frame, tiles it changed in are redrawn
+  std::vector<uint8_t> rate_map_;
+};
@@ -0,0 +1,56 @@
+#include <cstdint>
+
+#include "texture.h"
+
+namespace {
+
+// average four 32bit texels per channel
+uint32_t box4(uint32_t a, uint32_t b, uint32_t c, uint32_t d) {
+  // average the even and odd bytes separately so sums cant overflow
+  const uint32_t lo = ((a & 0x00ff00ff) + (b & 0x00ff00ff) +
+                       (c & 0x00ff00ff) + (d & 0x00ff00ff) + 0x00020002) >> 2;
+  const uint32_t hi = (((a >> 8) & 0x00ff00ff) + ((b >> 8) & 0x00ff00ff) +
+                       ((c >> 8) & 0x00ff00ff) + ((d >> 8) & 0x00ff00ff) +
+                       0x00020002) >> 2;
+  return (lo & 0x00ff00ff) | ((hi & 0x00ff00ff) << 8);
+}
+
+} // namespace {}
+
+bool texture_t::load(const uint32_t *src, uint32_t size, uint32_t pitch) {
+  // must be a non zero power of two
+  if (size == 0 || (size & (size - 1)) != 0) {
+    return false;
+  }
+
+  // find total storage for the whole chain
+  uint32_t total = 0;
+  for (uint32_t s = size; s; s >>= 1) {
+    total += s * s;
+  }
+  texels_.resize(total);
+  mips_.clear();
+
+  // swizzle the base level
+  uint32_t *dst = texels_.data();
+  for (uint32_t y = 0; y < size; ++y) {
+    const uint32_t *row = src + y * pitch;
+    for (uint32_t x = 0; x < size; ++x) {
+      dst[morton(x, y)] = row[x];
+    }
+  }
+  mips_.push_back(mip_t{dst, size, size - 1});
+
+  // in morton order the 2x2 parents of texel i are texels [4i, 4i+3] of the
+  // level above, so each mip is a linear pass over the previous one
+  for (uint32_t s = size >> 1; s; s >>= 1) {
+    const uint32_t *prev = dst;
+    dst += (s * 2) * (s * 2);
+    for (uint32_t i = 0; i < s * s; ++i) {
+      const uint32_t *p = prev + i * 4;
+      dst[i] = box4(p[0], p[1], p[2], p[3]);
+    }
+    mips_.push_back(mip_t{dst, s, s - 1});
+  }
+  return true;
+}
@@ -0,0 +1,126 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include <emmintrin.h>
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+
+enum tex_filter_t { TEX_FILTER_NEAREST, TEX_FILTER_BILINEAR };
+
+// spread the low 16 bits of v so that there is a zero bit between each
+inline uint32_t morton_spread(uint32_t v) {
+  v &= 0xffff;
+  v = (v | (v << 8)) & 0x00ff00ff;
+  v = (v | (v << 4)) & 0x0f0f0f0f;
+  v = (v | (v << 2)) & 0x33333333;
+  v = (v | (v << 1)) & 0x55555555;
+  return v;
+}
+
+// interleave x and y into a z-order index, x occupies the even bits
+inline uint32_t morton(uint32_t x, uint32_t y) {
+  return morton_spread(x) | (morton_spread(y) << 1);
+}
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+
+// a single mip level, texels are stored in morton order so that any 2x2
+// aligned quad is four consecutive texels, and so that texels close in 2d
+// are close in memory regardless of the direction we walk them
+struct mip_t {
+  const uint32_t *texels;
+  uint32_t size;  // width and height
+  uint32_t mask;  // size - 1, for wrap addressing
+};
+
+struct texture_t {
+
+  // build a texture from a linear 32bit source image, width and height must
+  // be the same power of two. the full mip chain is generated here.
+  bool load(const uint32_t *src, uint32_t size, uint32_t pitch);
+
+  // number of mip levels
+  uint32_t levels() const {
+    return uint32_t(mips_.size());
+  }
+
+  // return a mip level, clamped to the smallest
+  const mip_t &mip(int32_t level) const {
+    const int32_t last = int32_t(mips_.size()) - 1;
+    return mips_[level < 0 ? 0 : (level > last ? last : level)];
+  }
+
+  // base level size in texels
+  uint32_t size() const {
+    return mips_.empty() ? 0 : mips_[0].size;
+  }
+
+  // point sample, u and v are texel coordinates in 16.16 fixed point
+  static uint32_t sample_nearest(const mip_t &m, int32_t u, int32_t v) {
+    const uint32_t x = uint32_t(u >> 16) & m.mask;
+    const uint32_t y = uint32_t(v >> 16) & m.mask;
+    return m.texels[morton(x, y)];
+  }
+
+  // bilinear sample, u and v are texel coordinates in 16.16 fixed point
+  static uint32_t sample_bilinear(const mip_t &m, int32_t u, int32_t v);
+
+protected:
+  std::vector<uint32_t> texels_;
+  std::vector<mip_t> mips_;
+};
+
+// ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ---- ----
+
+inline uint32_t texture_t::sample_bilinear(const mip_t &m,
+                                          int32_t u,
+                                          int32_t v) {
+  // shift to texel centers
+  u -= 0x8000;
+  v -= 0x8000;
+
+  const uint32_t x0 = uint32_t(u >> 16) & m.mask;
+  const uint32_t y0 = uint32_t(v >> 16) & m.mask;
+
+  // load the 2x2 quad as t00, t10, t01, t11
+  __m128i quad;
+  if (((x0 | y0) & 1) == 0 && m.size > 1) {
+    // an even aligned quad is four consecutive texels in morton order, so
+    // the common case is a single load rather than a gather
+    quad = _mm_loadu_si128((const __m128i *)(m.texels + morton(x0, y0)));
+  } else {
+    const uint32_t x1 = (x0 + 1) & m.mask;
+    const uint32_t y1 = (y0 + 1) & m.mask;
+    const uint32_t mx0 = morton_spread(x0), mx1 = morton_spread(x1);
+    const uint32_t my0 = morton_spread(y0) << 1, my1 = morton_spread(y1) << 1;
+    quad = _mm_setr_epi32(m.texels[mx0 | my0], m.texels[mx1 | my0],
+                          m.texels[mx0 | my1], m.texels[mx1 | my1]);
+  }
+
+  // 8 bit weights in the range [0, 256]
+  const int16_t fx = int16_t((u >> 8) & 0xff);
+  const int16_t fy = int16_t((v >> 8) & 0xff);
+
+  const __m128i zero = _mm_setzero_si128();
+  // t00, t10 as 16bit lanes
+  const __m128i top = _mm_unpacklo_epi8(quad, zero);
+  // t01, t11 as 16bit lanes
+  const __m128i bot = _mm_unpackhi_epi8(quad, zero);
+
+  // vertical blend, a * (256 - f) + b * f fits in an unsigned 16bit lane
+  const __m128i wy0 = _mm_set1_epi16(int16_t(256 - fy));
+  const __m128i wy1 = _mm_set1_epi16(fy);
+  __m128i col = _mm_add_epi16(_mm_mullo_epi16(top, wy0),
+                              _mm_mullo_epi16(bot, wy1));
+  col = _mm_srli_epi16(col, 8);
+
+  // horizontal blend, left texel in the low half, right in the high half
+  const __m128i wx = _mm_setr_epi16(256 - fx, 256 - fx, 256 - fx, 256 - fx,
+                                    fx, fx, fx, fx);
+  col = _mm_mullo_epi16(col, wx);
+  col = _mm_add_epi16(col, _mm_srli_si128(col, 8));
+  col = _mm_srli_epi16(col, 8);
+
+  return uint32_t(_mm_cvtsi128_si32(_mm_packus_epi16(col, zero)));
+}
@@ -0,0 +1,35 @@
+#include <algorithm>
+
+#include "visbuf.h"
+
+const uint32_t visbuf_t::empty;
+
+void visbuf_t::init(uint32_t width, uint32_t height) {
+  width_ = width;
+  height_ = height;
+  id_.resize(width * height);
+  depth_.resize(width * height);
+  clear();
+}
+
+void visbuf_t::clear() {
+  std::fill(id_.begin(), id_.end(), empty);
+  std::fill(depth_.begin(), depth_.end(), 0.f);
+}
+
+void visbuf_t::runs(uint32_t y, std::vector<vis_run_t> &out) const {
+  out.clear();
+  const uint32_t *ids = id_row(y);
+  const int32_t w = int32_t(width_);
+  for (int32_t x = 0; x < w;) {
+    const uint32_t id = ids[x];
+    int32_t end = x + 1;
+    while (end < w && ids[end] == id) {
+      ++end;
+    }
+    if (id != empty) {
+      out.push_back(vis_run_t{x, end, id});
+    }
+    x = end;
+  }
+}
@@ -0,0 +1,82 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "math.h"
+#include "texture.h"
+
+// a horizontal run of pixels [x0, x1) showing triangle id
+struct vis_run_t {
+  int32_t x0, x1;
+  uint32_t id;
+};
+
+// a visibility buffer holds only the nearest triangle id and its depth for
+// each pixel. geometry is rasterized into it first and shading happens later
+// in a single pass, so each pixel is shaded exactly once however much
+// overdraw the scene has.
+struct visbuf_t {
+
+  visbuf_t()
+    : width_(0)
+    , height_(0)
+  {
+  }
+
+  // id of a pixel no triangle covers
+  static const uint32_t empty = 0xffffffff;
+
+  void init(uint32_t width, uint32_t height);
+
+  // reset every pixel to empty at infinite depth
+  void clear();
+
+  uint32_t *id_row(uint32_t y) {
+    return id_.data() + y * width_;
+  }
+
+  const uint32_t *id_row(uint32_t y) const {
+    return id_.data() + y * width_;
+  }
+
+  // depth is stored as 1/w so larger is nearer
+  float *depth_row(uint32_t y) {
+    return depth_.data() + y * width_;
+  }
+
+  // the runs of covered pixels sharing a triangle along a row
+  void runs(uint32_t y, std::vector<vis_run_t> &out) const;
+
+  uint32_t width() const {
+    return width_;
+  }
+
+  uint32_t height() const {
+    return height_;
+  }
+
+protected:
+  uint32_t width_, height_;
+  std::vector<uint32_t> id_;
+  std::vector<float> depth_;
+};
+
+// the triangles a visibility buffer's ids refer to, triangle n is made from
+// the screen space vertices index[n * 3 + 0..2]
+struct vis_mesh_t {
+  const math::vec4f_t *screen;
+  const uint32_t *index;
+};
+
+// a batch of triangles resolved by a hidden surface pass, identified by
+// ids from first on. it is textured when tex is given, gouraud shaded when
+// rgb is and otherwise flat shaded from tri_rgb.
+struct vis_batch_t {
+  vis_mesh_t mesh;
+  uint32_t first;
+  const uint32_t *tri_rgb;
+  const uint32_t *rgb;
+  const math::vec2f_t *uv;
+  const texture_t *tex;
+  tex_filter_t filter;
+};
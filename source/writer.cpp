@@ -0,0 +1,141 @@
+#include <cinttypes>
+
+#include "writer.h"
+
+frame_writer_t::frame_writer_t()
+  : format_(FRAME_PPM)
+  , width_(0)
+  , height_(0)
+  , stream_(nullptr)
+  , head_(0)
+  , tail_(0)
+  , queued_(0)
+  , frame_(0)
+  , quit_(false)
+  , failed_(false)
+  , stalls_(0)
+{
+}
+
+frame_writer_t::~frame_writer_t() {
+  close();
+}
+
+bool frame_writer_t::open(const char *path, frame_format_t format,
+                          uint32_t width, uint32_t height, uint32_t ring) {
+  close();
+  path_ = path;
+  format_ = format;
+  width_ = width;
+  height_ = height;
+  if (format == FRAME_PPM_STREAM) {
+    stream_ = fopen(path, "wb");
+    if (!stream_) {
+      return false;
+    }
+  }
+  rgb_.resize(width * 3);
+  ring_.assign(ring ? ring : 1, std::vector<uint32_t>(width * height));
+  head_ = tail_ = queued_ = frame_ = 0;
+  quit_ = false;
+  failed_ = false;
+  stalls_ = 0;
+  thread_ = std::thread(&frame_writer_t::worker, this);
+  return true;
+}
+
+uint32_t *frame_writer_t::acquire() {
+  std::unique_lock<std::mutex> guard(lock_);
+  if (queued_ == ring_.size()) {
+    ++stalls_;
+    changed_.wait(guard, [this]() { return queued_ < ring_.size(); });
+  }
+  return ring_[head_].data();
+}
+
+void frame_writer_t::submit() {
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    head_ = (head_ + 1) % uint32_t(ring_.size());
+    ++queued_;
+  }
+  changed_.notify_all();
+}
+
+void frame_writer_t::close() {
+  if (!thread_.joinable()) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    quit_ = true;
+  }
+  changed_.notify_all();
+  thread_.join();
+  if (stream_) {
+    if (fclose(stream_)) {
+      failed_ = true;
+    }
+    stream_ = nullptr;
+  }
+}
+
+void frame_writer_t::worker() {
+  for (;;) {
+    uint32_t slot, index;
+    {
+      std::unique_lock<std::mutex> guard(lock_);
+      changed_.wait(guard, [this]() { return quit_ || queued_ > 0; });
+      if (queued_ == 0) {
+        return;
+      }
+      slot = tail_;
+      index = frame_++;
+    }
+    // the slot stays queued while it is written so acquire cannot reuse it
+    write(ring_[slot].data(), index);
+    {
+      std::lock_guard<std::mutex> guard(lock_);
+      tail_ = (tail_ + 1) % uint32_t(ring_.size());
+      --queued_;
+    }
+    changed_.notify_all();
+  }
+}
+
+void frame_writer_t::write(const uint32_t *pixels, uint32_t index) {
+  FILE *fd = stream_;
+  if (!fd) {
+    char name[32];
+    snprintf(name, sizeof(name), "%05" PRIu32 ".%s", index,
+             (format_ == FRAME_RAW) ? "raw" : "ppm");
+    fd = fopen((path_ + name).c_str(), "wb");
+    if (!fd) {
+      failed_ = true;
+      return;
+    }
+  }
+  bool ok = true;
+  if (format_ == FRAME_RAW) {
+    const size_t n = size_t(width_) * height_;
+    ok = fwrite(pixels, 4, n, fd) == n;
+  } else {
+    ok = fprintf(fd, "P6\n%" PRIu32 " %" PRIu32 "\n255\n", width_,
+                 height_) > 0;
+    for (uint32_t y = 0; ok && y < height_; ++y) {
+      const uint32_t *row = pixels + y * width_;
+      for (uint32_t x = 0; x < width_; ++x) {
+        rgb_[x * 3 + 0] = uint8_t(row[x] >> 16);
+        rgb_[x * 3 + 1] = uint8_t(row[x] >> 8);
+        rgb_[x * 3 + 2] = uint8_t(row[x]);
+      }
+      ok = fwrite(rgb_.data(), 1, rgb_.size(), fd) == rgb_.size();
+    }
+  }
+  if (fd != stream_) {
+    ok &= fclose(fd) == 0;
+  }
+  if (!ok) {
+    failed_ = true;
+  }
+}
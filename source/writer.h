@@ -0,0 +1,77 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum frame_format_t {
+  // one binary ppm file per frame
+  FRAME_PPM,
+  // one file per frame of 32bit 0xAARRGGBB pixels
+  FRAME_RAW,
+  // every frame as a ppm one after another in a single file, which video
+  // tools read as an image pipe
+  FRAME_PPM_STREAM,
+};
+
+// writes frames to disk from a background thread so that rendering never
+// waits on io. frames are copied into a ring of slots, and rendering only
+// stalls when every slot is still queued.
+struct frame_writer_t {
+
+  frame_writer_t();
+  ~frame_writer_t();
+
+  // start writing frames of width x height. for the per frame formats path
+  // is a prefix that is followed by the frame number, for the stream it is
+  // the file itself.
+  bool open(const char *path, frame_format_t format, uint32_t width,
+            uint32_t height, uint32_t ring = 4);
+
+  // a free slot to copy the next frame into as linear 32bit pixels
+  uint32_t *acquire();
+
+  // queue the slot from acquire to be written
+  void submit();
+
+  // write every queued frame and stop the thread
+  void close();
+
+  // true if anything failed to write
+  bool failed() const {
+    return failed_;
+  }
+
+  // times acquire had to wait for the writer
+  uint32_t stalls() const {
+    return stalls_;
+  }
+
+protected:
+  void worker();
+  void write(const uint32_t *pixels, uint32_t index);
+
+  std::string path_;
+  frame_format_t format_;
+  uint32_t width_, height_;
+  FILE *stream_;
+  // conversion buffer for ppm rows
+  std::vector<uint8_t> rgb_;
+
+  std::vector<std::vector<uint32_t>> ring_;
+  // next slot to fill and next slot to write
+  uint32_t head_, tail_;
+  uint32_t queued_;
+  // frames submitted so far, numbering the files
+  uint32_t frame_;
+  bool quit_;
+  std::atomic<bool> failed_;
+  uint32_t stalls_;
+  std::mutex lock_;
+  std::condition_variable changed_;
+  std::thread thread_;
+};